@@ -0,0 +1,102 @@
+#pragma once
+#include "CommunicationHandler.h"
+#include "Error.h"
+
+#include <fmt/format.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Reference transport for benchmarks, one unix datagram socket per agent
+class UnixSocketCommunicationHandler : public scaf::CommunicationHandler {
+public:
+    static std::expected<UnixSocketCommunicationHandler, scaf::Error> create(const std::string& name) {
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (fd < 0)
+            return std::unexpected(scaf::Error(scaf::RetCode::generic_error, fmt::format("socket failed: {}", std::strerror(errno))));
+
+        sockaddr_un address = makeAddress(name);
+        unlink(address.sun_path);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            scaf::Error error(scaf::RetCode::generic_error, fmt::format("bind {} failed: {}", address.sun_path, std::strerror(errno)));
+            close(fd);
+            return std::unexpected(std::move(error));
+        }
+
+        UnixSocketCommunicationHandler handler;
+        handler.state = std::make_unique<State>();
+        handler.state->name = name;
+        handler.state->fd = fd;
+        handler.state->buffer.resize(maxDatagramSize);
+        return handler;
+    }
+
+    UnixSocketCommunicationHandler(UnixSocketCommunicationHandler&&) = default;
+
+    ~UnixSocketCommunicationHandler() override {
+        if (state) {
+            close(state->fd);
+            unlink(makeAddress(state->name).sun_path);
+        }
+    }
+
+    std::expected<void, scaf::Error> send(const std::string& to, const std::string& data) override {
+        sockaddr_un address = makeAddress(to);
+        if (sendto(state->fd, data.data(), data.size(), 0, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+            return std::unexpected(scaf::Error(scaf::RetCode::generic_error, fmt::format("sendto {} failed: {}", to, std::strerror(errno))));
+        return {};
+    }
+
+    std::expected<scaf::Data, scaf::Error> receive() override {
+        sockaddr_un address{};
+        socklen_t addressLength = sizeof(address);
+        ssize_t received = recvfrom(state->fd, state->buffer.data(), state->buffer.size(), 0, reinterpret_cast<sockaddr*>(&address), &addressLength);
+        if (state->stopped)
+            return std::unexpected(scaf::Error(scaf::RetCode::terminating, "Communication handler was stopped"));
+        if (received < 0)
+            return std::unexpected(scaf::Error(scaf::RetCode::generic_error, fmt::format("recvfrom failed: {}", std::strerror(errno))));
+
+        std::string path = address.sun_path;
+        std::string from = path.substr(prefix.size(), path.size() - prefix.size() - suffix.size());
+        return scaf::Data{.from = std::move(from), .data = std::string(state->buffer.data(), static_cast<std::size_t>(received))};
+    }
+
+    void stop() override {
+        state->stopped = true;
+        send(state->name, {});  // wakes up receive
+    }
+
+private:
+    UnixSocketCommunicationHandler() = default;
+
+    static sockaddr_un makeAddress(const std::string& name) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        fmt::format_to_n(address.sun_path, sizeof(address.sun_path) - 1, "{}{}{}", prefix, name, suffix);
+        return address;
+    }
+
+    struct State {
+        std::string name;
+        int fd = -1;
+        std::atomic_bool stopped = false;
+        std::vector<char> buffer;
+    };
+
+    static constexpr std::size_t maxDatagramSize = 1u << 16;
+    static constexpr std::string_view prefix = "/tmp/scaf.";
+    static constexpr std::string_view suffix = ".sock";
+
+    std::unique_ptr<State> state;
+};
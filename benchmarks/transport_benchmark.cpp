@@ -0,0 +1,149 @@
+#include <fmt/format.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <expected>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ShmCommunicationHandler.h"
+#include "UdpCommunicationHandler.h"
+#include "UnixSocketCommunicationHandler.h"
+
+// Compares transports between two processes on the same host:
+//   latency    - ping-pong round trips of small message
+//   throughput - one way stream of messages, receiver confirms the last one
+// Usage: scaf_benchmarks [round trips] [streamed messages]
+
+using Clock = std::chrono::steady_clock;
+
+struct Results {
+    double averageRoundTripUs;
+    double p50RoundTripUs;
+    double p99RoundTripUs;
+    double messagesPerSecond;
+    double megabytesPerSecond;
+};
+
+template <typename Handler>
+using Factory = std::function<std::expected<Handler, scaf::Error>(const std::string&)>;
+
+template <typename Handler>
+void echo(Handler& handler, const std::string& peer, int roundTrips, int streamed) {
+    for (int i = 0; i < roundTrips; ++i) {
+        std::expected received = handler.receive();
+        assert(received.has_value());
+        handler.send(peer, received->data);
+    }
+    for (int i = 0; i < streamed; ++i)
+        handler.receive();
+    handler.send(peer, "done");
+}
+
+template <typename Handler>
+Results run(const Factory<Handler>& create, int roundTrips, int streamed, std::size_t messageSize) {
+    const std::string parentName = "bench_parent";
+    const std::string childName = "bench_child";
+
+    std::expected parent = create(parentName);
+    if (not parent.has_value()) {
+        fmt::print(stderr, "{}\n", parent.error().getMessage());
+        std::exit(1);
+    }
+
+    int ready[2];
+    if (pipe(ready) != 0)
+        std::exit(1);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        {
+            std::expected child = create(childName);
+            char byte = child.has_value() ? 1 : 0;
+            [[maybe_unused]] ssize_t written = write(ready[1], &byte, 1);
+            if (child.has_value())
+                echo(child.value(), parentName, roundTrips, streamed);
+        }
+        _exit(0);  // parent's handler is not destroyed in child
+    }
+
+    char byte = 0;
+    if (read(ready[0], &byte, 1) != 1 or byte != 1) {
+        fmt::print(stderr, "child process failed to create transport\n");
+        std::exit(1);
+    }
+
+    const std::string message(messageSize, 'x');
+    std::vector<double> roundTripsUs;
+    roundTripsUs.reserve(static_cast<std::size_t>(roundTrips));
+
+    const Clock::time_point latencyStart = Clock::now();
+    for (int i = 0; i < roundTrips; ++i) {
+        const Clock::time_point start = Clock::now();
+        parent->send(childName, message);
+        parent->receive();
+        roundTripsUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    const double latencyTotalUs = std::chrono::duration<double, std::micro>(Clock::now() - latencyStart).count();
+
+    const Clock::time_point streamStart = Clock::now();
+    std::jthread confirmation([&] { parent->receive(); });  // like listening thread of agent, lets transport handle acknowledgements
+    for (int i = 0; i < streamed; ++i) {
+        while (not parent->send(childName, message).has_value())
+            ;  // full ring or socket buffer
+    }
+    confirmation.join();
+    const double streamSeconds = std::chrono::duration<double>(Clock::now() - streamStart).count();
+
+    waitpid(pid, nullptr, 0);
+    close(ready[0]);
+    close(ready[1]);
+
+    std::ranges::sort(roundTripsUs);
+    return Results{
+        .averageRoundTripUs = latencyTotalUs / roundTrips,
+        .p50RoundTripUs = roundTripsUs[roundTripsUs.size() / 2],
+        .p99RoundTripUs = roundTripsUs[roundTripsUs.size() * 99 / 100],
+        .messagesPerSecond = streamed / streamSeconds,
+        .megabytesPerSecond = streamed * static_cast<double>(messageSize) / streamSeconds / 1e6,
+    };
+}
+
+void print(const std::string& transport, std::size_t messageSize, const Results& results) {
+    fmt::print("{:<12} {:>8} {:>10.2f} {:>10.2f} {:>10.2f} {:>14.0f} {:>10.1f}\n", transport, messageSize, results.averageRoundTripUs,
+               results.p50RoundTripUs, results.p99RoundTripUs, results.messagesPerSecond, results.megabytesPerSecond);
+}
+
+int main(int argc, char** argv) {
+    const int roundTrips = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const int streamed = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+    Factory<scaf::ShmCommunicationHandler> shm = [](const std::string& name) { return scaf::ShmCommunicationHandler::create(name); };
+    Factory<UnixSocketCommunicationHandler> unixSocket = [](const std::string& name) { return UnixSocketCommunicationHandler::create(name); };
+    auto udpFactory = [](bool reliable) -> Factory<scaf::UdpCommunicationHandler> {
+        return [reliable](const std::string& name) {
+            const std::map<std::string, std::uint16_t> ports = {{"bench_parent", 47101}, {"bench_child", 47102}};
+            scaf::UdpOptions options;
+            options.port = ports.at(name);
+            options.reliable = reliable;
+            for (const auto& [peer, port] : ports)
+                options.peers.emplace(peer, fmt::format("127.0.0.1:{}", port));
+            return scaf::UdpCommunicationHandler::create(options);
+        };
+    };
+
+    fmt::print("{:<12} {:>8} {:>10} {:>10} {:>10} {:>14} {:>10}\n", "transport", "bytes", "rtt avg us", "rtt p50 us", "rtt p99 us", "messages/s", "MB/s");
+    for (std::size_t messageSize : {64u, 512u, 4096u}) {
+        print("unix socket", messageSize, run(unixSocket, roundTrips, streamed, messageSize));
+        print("shm", messageSize, run(shm, roundTrips, streamed, messageSize));
+        print("udp reliable", messageSize, run(udpFactory(true), roundTrips, streamed, messageSize));
+    }
+}
@@ -41,7 +41,25 @@ struct AclMessageBuilder {
     std::optional<std::string> inReplyTo = std::nullopt;
     std::optional<std::chrono::system_clock::time_point> replyBy = std::nullopt;
 
-    operator AclMessage() const {
+    operator AclMessage() const& {
+        return AclMessage{
+            .performative = this->performative,
+            .sender = {},
+            .receiver = {},
+            .replyTo = this->replyTo,
+            .content = this->content,
+            .language = {},
+            .encoding = {},
+            .ontology = this->ontology,
+            .protocol = this->protocol,
+            .conversationId = {},
+            .replyWith = this->replyWith,
+            .inReplyTo = this->inReplyTo,
+            .replyBy = this->replyBy
+        };
+    }
+
+    operator AclMessage() && {
         return AclMessage{
             .performative = this->performative,
             .sender = {},
@@ -54,7 +72,7 @@ struct AclMessageBuilder {
             .protocol = std::move(this->protocol),
             .conversationId = {},
             .replyWith = std::move(this->replyWith),
-            .inReplyTo =std::move(this->inReplyTo),
+            .inReplyTo = std::move(this->inReplyTo),
             .replyBy = std::move(this->replyBy)
         };
     }
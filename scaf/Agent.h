@@ -1,15 +1,33 @@
 #pragma once
 #include "AclMessage.h"
+#include "AsyncSender.h"
 #include "Behaviour.h"
+#include "BehaviourSet.h"
 #include "CommunicationHandler.h"
+#include "CompactAclMessage.h"
+#include "ContentStream.h"
 #include "ConversationHandler.h"
+#include "CorrelationTable.h"
+#include "DeadlineScheduler.h"
 #include "ErrorHandler.h"
+#include "ErrorPipeline.h"
 #include "JsonSerializer.h"
+#include "ResponseCache.h"
+#include "SubscriptionManager.h"
 #include "Uid.h"
 
+#include <chrono>
 #include <concepts>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <source_location>
+#include <span>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
 #include <utility>
@@ -23,34 +41,87 @@ class Agent {
 public:
     explicit Agent(const std::string& name)
         : name(name)
-        , conversationHandler(this) {}
+        , conversationHandler(this)
+        , subscriptionManager(this)
+        , asyncSender(this)
+        , deadlineScheduler(this) {}
 
     explicit Agent(const std::string& name, _CommunicationHandler&& communicationHandler, _ErrorHandler&& errorHandler)
         : name(name)
         , communicationHandler(std::move(communicationHandler))
         , errorHandler(std::move(errorHandler))
-        , conversationHandler(this) {}
+        , conversationHandler(this)
+        , subscriptionManager(this)
+        , asyncSender(this)
+        , deadlineScheduler(this) {}
 
     virtual ~Agent() {
         finished = true;
+        correlationTable.stop();
+        deadlineScheduler.stop();
+        subscriptionManager.stop();
+        asyncSender.stop();
         communicationHandler.stop();
+        if (listeningThread.joinable()) {  // errors reported while listening are still handled by pipeline
+            listeningThread.request_stop();
+            listeningThread.join();
+        }
+        if (errorPipeline)
+            errorPipeline->stop();
     }
     Agent(const Agent&) = delete;
     Agent(Agent&&) = delete;
 
     void handleData(Data data) {
         auto ret = safeCall([&]{
-            std::expected message = serializer.deserialize(data.data);
-            if (message.has_value())
-                conversationHandler.handleMessage(message.value());
-            else
-                errorHandler.handle(message.error());
+            for (std::expected<CompactAclMessage, Error>& message : serializer.deserializeCompactBatch(data.data)) {
+                if (not message.has_value())
+                    reportError(message.error(), data.from);
+                else if (deadlineScheduler.isEnabled())
+                    deadlineScheduler.push(std::move(message.value()));
+                else
+                    dispatchMessage(std::move(message.value()));
+            }
         });
         if (!ret) {
-            errorHandler.handle(ret.error());
+            reportError(ret.error(), data.from);
         }
     }
 
+    // errors are passed to errorHandler by separate thread with deduplication and rate limiting, has to be called before startListening
+    void enableAsyncErrorReporting(const ErrorPipelineOptions& options = {}) {
+        if (not errorPipeline)
+            errorPipeline = std::make_unique<ErrorPipeline>(errorHandler, options);
+    }
+
+    // received messages are processed by separate thread in earliest deadline first order, has to be called before startListening
+    void enableDeadlineScheduling(const DeadlineSchedulerOptions& options = {}) {
+        deadlineScheduler.enable(options);
+    }
+
+    // replies to query_ref and query_if are cached and repeated requests are answered without creating behaviour,
+    // has to be called before startListening
+    void enableResponseCache(const ResponseCacheOptions& options = {}) {
+        if (not responseCache)
+            responseCache = std::make_unique<ResponseCache>(options);
+    }
+
+    DeadlineStatistics getDeadlineStatistics() {
+        return deadlineScheduler.getStatistics();
+    }
+
+    std::optional<ErrorPipelineStatistics> getErrorStatistics() const {
+        if (not errorPipeline)
+            return std::nullopt;
+        return errorPipeline->getStatistics();
+    }
+
+    std::optional<ResponseCacheStatistics> getResponseCacheStatistics() {
+        if (not responseCache)
+            return std::nullopt;
+        return responseCache->getStatistics();
+    }
+
     void startListening() {
         listeningThread = std::jthread([&](std::stop_token stoken) {
             while(not finished and not stoken.stop_requested())
@@ -62,18 +133,29 @@ public:
         return finished;
     }
 
-    using AgentBehaviour = _Behaviour;
+    using AgentBehaviour = _Behaviour;  // single behaviour or Behaviours<...> bound to protocols and performatives
+    using DefaultBehaviour = BehaviourSetOf<_Behaviour>::Default;
 
 protected:
-    virtual std::shared_ptr<_Behaviour> createConversation(const decltype(AclMessage::receiver)& receiver) {
+    virtual std::shared_ptr<DefaultBehaviour> createConversation(const decltype(AclMessage::receiver)& receiver) {
         return conversationHandler.createNewConversation(receiver);
     }
 
+    // for agent with multiple behaviours, conversation is handled by given behaviour
+    template <typename _ConversationBehaviour>
+    std::shared_ptr<_ConversationBehaviour> createConversation(const decltype(AclMessage::receiver)& receiver) {
+        return conversationHandler.template createNewConversation<_ConversationBehaviour>(receiver);
+    }
+
     // it is recommended to use sendMessage member function over direct communicationHandler call
     std::expected<void, Error> sendMessage(const Behaviour<typename AgentBehaviour::Agent>& behaviour, AclMessage&& message) {
         UniqueConversationId uid = behaviour.getUid();
         message.receiver = uid.sender;
         message.conversationId = uid.conversationId;
+        if (responseCache) {
+            if (std::optional<ResponseCacheKey> request = responseCache->takePending(uid); request and ResponseCache::isCacheableReply(message))
+                return sendCacheable(std::move(message), std::move(request.value()));
+        }
         return send(std::move(message));
     }
 
@@ -82,11 +164,122 @@ protected:
         return send(std::move(message));
     }
 
+    // doesn't block, message is serialized and passed to transport by separate thread, reply sent this way isn't cached
+    SendHandle sendMessageAsync(const Behaviour<typename AgentBehaviour::Agent>& behaviour, AclMessage&& message) {
+        UniqueConversationId uid = behaviour.getUid();
+        message.receiver = uid.sender;
+        message.conversationId = uid.conversationId;
+        if (responseCache)
+            responseCache->takePending(uid);
+        return sendAsync(std::move(message));
+    }
+
+    SendHandle sendMessageAsync(AclMessage&& message) {
+        message.conversationId = conversationHandler.generateConversationId();
+        return sendAsync(std::move(message));
+    }
+
+    // reply (message with inReplyTo equal to replyWith of request) is passed to callback instead of behaviour,
+    // if deadline is not set replyBy is used, replyWith is generated if not set
+    std::expected<void, Error> sendRequest(AclMessage&& message, ReplyCallback callback, std::optional<CorrelationTable::Clock::time_point> deadline = std::nullopt) {
+        message.conversationId = conversationHandler.generateConversationId();
+        return sendCorrelated(std::move(message), std::move(callback), deadline);
+    }
+
+    std::expected<void, Error> sendRequest(const Behaviour<typename AgentBehaviour::Agent>& behaviour, AclMessage&& message,
+                                           ReplyCallback callback, std::optional<CorrelationTable::Clock::time_point> deadline = std::nullopt) {
+        UniqueConversationId uid = behaviour.getUid();
+        message.receiver = uid.sender;
+        message.conversationId = uid.conversationId;
+        return sendCorrelated(std::move(message), std::move(callback), deadline);
+    }
+
+    std::future<std::expected<AclMessage, Error>> sendRequest(AclMessage&& message, std::optional<CorrelationTable::Clock::time_point> deadline = std::nullopt) {
+        auto promise = std::make_shared<std::promise<std::expected<AclMessage, Error>>>();
+        std::future reply = promise->get_future();
+        std::expected status = sendRequest(std::move(message), [promise](std::expected<AclMessage, Error>&& reply) {
+            promise->set_value(std::move(reply));
+        }, deadline);
+
+        if (not status.has_value())
+            promise->set_value(std::unexpected(status.error()));
+        return reply;
+    }
+
+    // content is sent in chunks of at most chunkSize bytes interleaved with other messages sent asynchronously,
+    // receiving behaviour gets them through handleContentChunkImpl, reply for sendRequest is reassembled and passed
+    // to its callback. Later messages of the same conversation are sent after the last chunk. Content is serialized
+    // at once, so sender needs memory for whole serialized content.
+    SendHandle sendMessageChunked(const Behaviour<typename AgentBehaviour::Agent>& behaviour, AclMessage&& message, std::size_t chunkSize = defaultChunkSize) {
+        UniqueConversationId uid = behaviour.getUid();
+        message.receiver = uid.sender;
+        message.conversationId = uid.conversationId;
+        return sendChunked(std::move(message), chunkSize);
+    }
+
+    SendHandle sendMessageChunked(AclMessage&& message, std::size_t chunkSize = defaultChunkSize) {
+        message.conversationId = conversationHandler.generateConversationId();
+        return sendChunked(std::move(message), chunkSize);
+    }
+
+    void setAsyncSendOptions(const AsyncSendOptions& options) {
+        asyncSender.setOptions(options);
+    }
+
+    // errors are reported also by sender, subscription and scheduler threads, errorHandler is never called concurrently
+    void reportError(const Error& error, std::string_view sender = {}, std::source_location sl = std::source_location::current()) {
+        if (errorPipeline) {
+            errorPipeline->report(error, sender, sl);
+        } else {
+            std::scoped_lock guard(errorHandlerMutex);
+            errorHandler.handle(error);
+        }
+    }
+
+    // removes cached responses matching predicate (all without predicate), e.g. when facts they were computed from change
+    std::size_t invalidateCachedResponses(const std::function<bool(const ResponseCacheKey&)>& predicate = nullptr) {
+        return responseCache ? responseCache->invalidate(predicate) : 0u;
+    }
+
     virtual std::string getMessageReceiver(const AclMessage& message) {
         return message.receiver;
     }
 
+    // Topic of received subscribe or request_whenever, conversation is subscribed to it before behaviour handles the
+    // message. By default content is the topic or object with "topic" member, without topic behaviour has to call
+    // addSubscriber itself.
+    virtual std::optional<std::string> getSubscriptionTopic(const AclMessage& message) {
+        const nlohmann::json& content = message.content;
+        if (content.is_string())
+            return content.get<std::string>();
+        if (auto topic = content.find("topic"); content.is_object() and topic != content.end() and topic->is_string())
+            return topic->template get<std::string>();
+        return std::nullopt;
+    }
+
+    // subscriber is identified by conversation in which subscribe or request_whenever was received
+    void addSubscriber(const std::string& topic, const Behaviour<typename AgentBehaviour::Agent>& behaviour,
+                       typename SubscriptionManager<Agent>::Predicate predicate = nullptr) {
+        subscribeConversation(topic, behaviour.getUid(), std::move(predicate));
+    }
+
+    void removeSubscriber(const Behaviour<typename AgentBehaviour::Agent>& behaviour) {
+        subscriptionManager.unsubscribe(behaviour.getUid());
+    }
+
+    // sends notification to every subscriber of the topic, receiver and conversationId are set automatically
+    std::expected<void, Error> publish(const std::string& topic, AclMessage&& notification) {
+        std::expected status = subscriptionManager.publish(topic, std::move(notification));
+        if (not status.has_value())
+            reportError(status.error());
+
+        return status;
+    }
+
     friend class ConversationHandler<Agent>;
+    friend class SubscriptionManager<Agent>;
+    friend class AsyncSender<Agent>;
+    friend class DeadlineScheduler<Agent>;
     friend _Behaviour;
     friend Behaviour<typename AgentBehaviour::Agent>;
 
@@ -96,7 +289,16 @@ protected:
     JsonSerializer serializer;
     _CommunicationHandler communicationHandler;
     _ErrorHandler errorHandler;
+    std::mutex errorHandlerMutex;
+    std::unique_ptr<ErrorPipeline> errorPipeline;
+    std::unique_ptr<ResponseCache> responseCache;
     ConversationHandler<Agent> conversationHandler;
+    SubscriptionManager<Agent> subscriptionManager;
+    AsyncSender<Agent> asyncSender;
+    CorrelationTable correlationTable;
+    std::mutex chunkedRepliesMutex;
+    std::map<std::pair<std::string, std::string>, ContentReassembler> chunkedReplies;  // by sender and inReplyTo
+    DeadlineScheduler<Agent> deadlineScheduler;
     std::jthread listeningThread;
     std::atomic_bool finished = false;
 
@@ -104,38 +306,193 @@ private:
 
     virtual void work() = 0;
 
+    void subscribeConversation(const std::string& topic, const UniqueConversationId& uid, typename SubscriptionManager<Agent>::Predicate predicate = nullptr) {
+        std::string address = getMessageReceiver(AclMessage{.performative = Performative::subscribe, .receiver = uid.sender, .content = {}, .protocol = {}});
+        subscriptionManager.subscribe(topic, uid, std::move(address), std::move(predicate));
+    }
+
+    // subscribe and request_whenever add subscriber of the conversation, cancel removes it
+    void routeSubscription(const UniqueConversationId& uid, const AclMessage& message) {
+        switch (message.performative) {
+        case Performative::subscribe:
+        case Performative::request_whenever:
+            if (std::optional<std::string> topic = getSubscriptionTopic(message))
+                subscribeConversation(topic.value(), uid);
+            break;
+        case Performative::cancel:
+            subscriptionManager.unsubscribe(uid);
+            break;
+        default:
+            break;
+        }
+    }
+
     std::expected<void, Error> send(AclMessage&& message) {
         message.sender = name;
-        std::expected status = serializer.serialize(message)
-            .and_then([&](const std::string& data){ return communicationHandler.send(getMessageReceiver(message), data); });
+        std::expected<void, Error> status;
+        if constexpr (InPlaceSending<_CommunicationHandler>) {
+            status = communicationHandler.sendInPlace(getMessageReceiver(message), [&](std::streambuf& output) {
+                return serializer.serializeInto(message, output);
+            });
+        } else {
+            status = serializer.serialize(message)
+                .and_then([&](const std::string& data){ return communicationHandler.send(getMessageReceiver(message), data); });
+        }
 
         if (not status.has_value())
-            errorHandler.handle(status.error());
+            reportError(status.error(), message.receiver);
 
         return status;
     }
 
+    std::expected<void, Error> sendCorrelated(AclMessage&& message, ReplyCallback&& callback, std::optional<CorrelationTable::Clock::time_point> deadline) {
+        if (not deadline.has_value())
+            deadline = message.replyBy;
+
+        if (message.replyWith.has_value())
+            correlationTable.add(message.replyWith.value(), message.receiver, std::move(callback), deadline);
+        else
+            message.replyWith = correlationTable.add(message.receiver, std::move(callback), deadline);
+
+        std::string replyWith = message.replyWith.value();
+        std::expected status = send(std::move(message));
+        if (not status.has_value())
+            correlationTable.remove(replyWith);
+
+        return status;
+    }
+
+    SendHandle sendAsync(AclMessage&& message) {
+        message.sender = name;
+        std::string address = getMessageReceiver(message);
+        return asyncSender.enqueue(std::move(address), std::move(message));
+    }
+
+    // received message stays compact until it reaches callback or behaviour
+    void dispatchMessage(CompactAclMessage&& message) {
+        // replies for requests sent with sendRequest don't reach behaviours, message is moved only if matched
+        if (message.inReplyTo().has_value()) {
+            if (mayBeContentChunk(message) ? completeChunkedReply(message) : correlationTable.complete(std::move(message)))
+                return;
+        }
+        if (responseCache and ResponseCache::isCacheableRequest(message) and startsConversation(message) and replyFromCache(message))
+            return;
+        conversationHandler.handleMessage(message);
+    }
+
+    // chunks of reply are collected until all of them arrive, then callback of request gets reply with complete
+    // content. Content is parsed only if reply belongs to pending request, so message for behaviour is parsed once.
+    bool completeChunkedReply(const CompactAclMessage& message) {
+        std::pair<std::string, std::string> stream(message.sender(), message.inReplyTo().value());
+        {
+            std::scoped_lock guard(chunkedRepliesMutex);
+            if (not chunkedReplies.contains(stream) and not correlationTable.contains(stream.second, stream.first))
+                return false;
+        }
+
+        AclMessage reply = message.toAclMessage();
+        std::optional<ContentChunk> chunk = getContentChunk(reply);
+        if (not chunk.has_value())
+            return correlationTable.complete(std::move(reply));  // only text of content contains chunk key
+
+        std::expected<std::optional<nlohmann::json>, Error> content;
+        {
+            std::scoped_lock guard(chunkedRepliesMutex);
+            auto it = chunkedReplies.find(stream);
+            if (it == chunkedReplies.end()) {
+                if (not correlationTable.contains(stream.second, stream.first))
+                    return false;  // request expired in the meantime
+                it = chunkedReplies.emplace(stream, ContentReassembler()).first;
+            }
+
+            content = it->second.append(chunk.value());
+            if (not content.has_value() or content->has_value())
+                chunkedReplies.erase(it);
+        }
+
+        if (not content.has_value()) {
+            correlationTable.fail(stream.second, stream.first, content.error());
+        } else if (content->has_value()) {
+            reply.content = std::move(content->value());
+            correlationTable.complete(std::move(reply));  // request could expire while chunks were received
+        }
+        return true;
+    }
+
+    // request in running conversation is handled by its behaviour, which could answer it differently than cache
+    bool startsConversation(const CompactAclMessage& message) {
+        return not conversationHandler.hasConversation(UniqueConversationId(message.getConversationId(), std::string(message.sender())));
+    }
+
+    bool replyFromCache(const CompactAclMessage& request) {
+        std::optional<ResponseCache::Body> body = responseCache->lookup(request);
+        if (not body.has_value())
+            return false;
+
+        std::string address = getMessageReceiver(AclMessage{.performative = Performative::inform, .receiver = std::string(request.sender()), .content = {},
+                                                            .protocol = std::string(request.protocol())});
+        std::string header = serializer.serializeEnvelope(request.sender(), request.getConversationId(), request.replyWith());
+        const SharedData reply{.to = address, .header = header, .body = std::move(body.value())};
+        std::expected status = communicationHandler.sendBatch(std::span(&reply, 1));
+        if (not status.has_value())
+            reportError(status.error(), request.sender());
+        return true;
+    }
+
+    // reply is serialized once without per-requester fields, the same body is then used for cache hits
+    std::expected<void, Error> sendCacheable(AclMessage&& message, ResponseCacheKey&& request) {
+        message.sender = name;
+        std::expected body = serializer.serializeSharedReply(message);
+        if (not body.has_value()) {
+            reportError(body.error(), message.receiver);
+            return std::unexpected(body.error());
+        }
+
+        std::string address = getMessageReceiver(message);
+        std::string header = serializer.serializeEnvelope(message.receiver, message.conversationId, message.inReplyTo);
+        const SharedData reply{.to = address, .header = header, .body = body.value()};
+        std::expected status = communicationHandler.sendBatch(std::span(&reply, 1));
+        if (not status.has_value()) {
+            reportError(status.error(), message.receiver);
+            return status;
+        }
+
+        responseCache->insert(std::move(request), std::move(body.value()));
+        return status;
+    }
+
+    SendHandle sendChunked(AclMessage&& message, std::size_t chunkSize) {
+        message.sender = name;
+        std::string address = getMessageReceiver(message);
+        return asyncSender.enqueueChunked(std::move(address), std::move(message), chunkSize);
+    }
+
     void listenForMessage() {
         std::expected<Data, Error> received = communicationHandler.receive();
 
         if (received.has_value()) {
-            handleData(received.value());
+            handleData(std::move(received.value()));
         } else {
             Error error = received.error();
             if (error.getRetCode() == RetCode::terminating)
                 return;
 
-            errorHandler.handle(error);
+            reportError(error);
         }
     }
 
-    virtual std::shared_ptr<_Behaviour> createBehaviour(UniqueConversationId uid) {
-        static_assert(std::derived_from<typename _Behaviour::Agent, Agent>);
-        if constexpr (std::is_same_v<typename _Behaviour::Agent, std::remove_cvref_t<decltype(*this)>>) {
-            return std::make_shared<_Behaviour>(this, uid);
+    virtual std::shared_ptr<DefaultBehaviour> createBehaviour(UniqueConversationId uid) {
+        return createBehaviour<DefaultBehaviour>(uid);
+    }
+
+    template <typename _ConversationBehaviour>
+    std::shared_ptr<_ConversationBehaviour> createBehaviour(UniqueConversationId uid) {
+        static_assert(std::derived_from<typename _ConversationBehaviour::Agent, Agent>);
+        if constexpr (std::is_same_v<typename _ConversationBehaviour::Agent, std::remove_cvref_t<decltype(*this)>>) {
+            return std::make_shared<_ConversationBehaviour>(this, uid);
         } else {
-            auto* agentSpecialization = static_cast<typename _Behaviour::Agent*>(this);
-            return std::make_shared<_Behaviour>(agentSpecialization, uid);
+            auto* agentSpecialization = static_cast<typename _ConversationBehaviour::Agent*>(this);
+            return std::make_shared<_ConversationBehaviour>(agentSpecialization, uid);
         }
     }
 };
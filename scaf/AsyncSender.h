@@ -0,0 +1,305 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "ContentStream.h"
+#include "Error.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace scaf {
+
+struct AsyncSendOptions {
+    std::size_t maxBatchSize = 64;                       // max messages taken from queue at once
+    std::chrono::microseconds flushLatency{100};         // how long to wait for more messages to complete batch
+};
+
+namespace details {
+    struct SendCompletion {
+        std::atomic_bool done = false;
+        std::optional<Error> error = std::nullopt;
+
+        void complete(const std::expected<void, Error>& status) {
+            if (not status.has_value())
+                error = status.error();
+            done.store(true, std::memory_order_release);
+            done.notify_all();
+        }
+    };
+}
+
+// Completion of message sent with Agent::sendMessageAsync
+class SendHandle {
+public:
+    SendHandle() = default;
+    explicit SendHandle(std::shared_ptr<details::SendCompletion> completion) : completion(std::move(completion)) {}
+
+    bool isReady() const {
+        return not completion or completion->done.load(std::memory_order_acquire);
+    }
+
+    std::expected<void, Error> wait() const {
+        if (not completion)
+            return {};
+        completion->done.wait(false, std::memory_order_acquire);
+        if (completion->error.has_value())
+            return std::unexpected(completion->error.value());
+        return {};
+    }
+
+private:
+    std::shared_ptr<details::SendCompletion> completion;
+};
+
+// Sends messages on separate thread. Messages taken from queue at once are grouped by receiver and every group
+// is serialized as json array into one reused buffer and passed to transport in single write.
+// Messages are sent by one thread in order of enqueueing, so order for every receiver is preserved.
+// Content of chunked messages is sent one chunk per stream between batches of other messages, messages of
+// the same receiver and conversation enqueued after chunked one wait until its last chunk is sent.
+// Content of chunked message is serialized at once when its stream starts, so memory used by stream is
+// proportional to size of content, not to chunk size.
+template <typename _Agent>
+class AsyncSender {
+public:
+    explicit AsyncSender(_Agent* correspondingAgent) : correspondingAgent(correspondingAgent) {}
+
+    ~AsyncSender() {
+        stop();
+    }
+    AsyncSender(const AsyncSender&) = delete;
+    AsyncSender(AsyncSender&&) = delete;
+
+    // has to be called before first message is sent
+    void setOptions(const AsyncSendOptions& newOptions) {
+        std::scoped_lock guard(queueMutex);
+        options = newOptions;
+        if (options.maxBatchSize == 0)
+            options.maxBatchSize = 1;
+    }
+
+    SendHandle enqueue(std::string address, AclMessage&& message) {
+        return push(Outbound{.address = std::move(address), .message = std::move(message), .completion = nullptr, .chunkSize = std::nullopt});
+    }
+
+    // content of message is sent in chunks of at most chunkSize bytes, handle is completed after the last one
+    SendHandle enqueueChunked(std::string address, AclMessage&& message, std::size_t chunkSize) {
+        return push(Outbound{.address = std::move(address), .message = std::move(message), .completion = nullptr, .chunkSize = chunkSize});
+    }
+
+    // sends everything enqueued so far and stops sender thread
+    void stop() {
+        {
+            std::scoped_lock guard(queueMutex);
+            stopped = true;
+        }
+        if (sender.joinable()) {
+            sender.request_stop();
+            sender.join();
+        }
+    }
+
+private:
+    struct Outbound {
+        std::string address;
+        AclMessage message;
+        std::shared_ptr<details::SendCompletion> completion;
+        std::optional<std::size_t> chunkSize;
+    };
+
+    struct OutboundStream {
+        Outbound outbound;
+        ContentSplitter splitter;
+        std::vector<Outbound> held;  // later messages of the same conversation
+    };
+
+    SendHandle push(Outbound&& outbound) {
+        auto completion = std::make_shared<details::SendCompletion>();
+        {
+            std::scoped_lock guard(queueMutex);
+            if (stopped) {
+                completion->complete(std::unexpected(Error(RetCode::terminating, "Agent is stopping, message was not sent")));
+                return SendHandle(std::move(completion));
+            }
+            outbound.completion = completion;
+            queue.push_back(std::move(outbound));
+            if (not sender.joinable())
+                sender = std::jthread([this](std::stop_token stoken) { run(stoken); });
+        }
+        queueCondition.notify_one();
+        return SendHandle(std::move(completion));
+    }
+
+    struct Group {
+        std::string_view address;
+        std::vector<Outbound*> messages;
+    };
+
+    void run(std::stop_token stoken) {
+        std::vector<Outbound> batch;
+        std::vector<Group> groups;
+        std::vector<OutboundStream> streams;
+        std::string buffer;
+
+        while (true) {
+            {
+                std::unique_lock lock(queueMutex);
+                if (streams.empty() and batch.empty()) {
+                    queueCondition.wait(lock, stoken, [&] { return not queue.empty(); });
+                    if (queue.empty())
+                        return;  // stop requested and nothing left to send
+
+                    if (queue.size() < options.maxBatchSize and not stoken.stop_requested())
+                        queueCondition.wait_for(lock, stoken, options.flushLatency, [&] { return queue.size() >= options.maxBatchSize; });
+                }
+
+                const std::size_t count = std::min(queue.size(), options.maxBatchSize);
+                std::move(queue.begin(), queue.begin() + count, std::back_inserter(batch));
+                queue.erase(queue.begin(), queue.begin() + count);
+            }
+
+            route(batch, streams);
+            groupByReceiver(batch, groups);
+            for (Group& group : groups)
+                sendGroup(group, buffer);
+            batch.clear();
+
+            // messages held by finished stream are sent with the next batch, before anything enqueued later
+            std::erase_if(streams, [&](OutboundStream& stream) {
+                if (not sendNextChunk(stream, buffer))
+                    return false;
+                std::ranges::move(stream.held, std::back_inserter(batch));
+                return true;
+            });
+        }
+    }
+
+    // messages of conversation with active stream are held by the stream, chunked messages start new streams,
+    // only messages which can be sent right away are left in batch
+    void route(std::vector<Outbound>& batch, std::vector<OutboundStream>& streams) {
+        std::vector<Outbound> ready;
+        ready.reserve(batch.size());
+        for (Outbound& outbound : batch) {
+            auto stream = std::ranges::find_if(streams, [&](const OutboundStream& active) {
+                return active.outbound.address == outbound.address and active.outbound.message.conversationId == outbound.message.conversationId;
+            });
+            if (stream != streams.end())
+                stream->held.push_back(std::move(outbound));
+            else if (outbound.chunkSize.has_value())
+                startStream(std::move(outbound), streams);
+            else
+                ready.push_back(std::move(outbound));
+        }
+        batch = std::move(ready);
+    }
+
+    void startStream(Outbound&& outbound, std::vector<OutboundStream>& streams) {
+        std::expected<std::string, Error> content = safeCall([&] { return outbound.message.content.dump(); });
+        if (not content.has_value()) {
+            correspondingAgent->reportError(content.error(), outbound.message.receiver);
+            outbound.completion->complete(std::unexpected(content.error()));
+            return;
+        }
+
+        outbound.message.content = nullptr;
+        const std::size_t chunkSize = outbound.chunkSize.value();
+        streams.push_back(OutboundStream{.outbound = std::move(outbound), .splitter = ContentSplitter(nextStreamId++, std::move(content.value()), chunkSize), .held = {}});
+    }
+
+    // returns true if stream is finished
+    bool sendNextChunk(OutboundStream& stream, std::string& buffer) {
+        AclMessage chunkMessage = stream.outbound.message;
+        chunkMessage.content = makeChunkContent(stream.splitter.next());
+
+        buffer.clear();
+        std::expected status = correspondingAgent->serializer.serializeInto(chunkMessage, buffer);
+        if (status.has_value())
+            status = correspondingAgent->communicationHandler.send(stream.outbound.address, buffer);
+
+        if (not status.has_value()) {
+            correspondingAgent->reportError(status.error(), stream.outbound.address);
+            stream.outbound.completion->complete(status);
+            return true;
+        }
+
+        if (stream.splitter.finished())
+            stream.outbound.completion->complete(status);
+        return stream.splitter.finished();
+    }
+
+    static void groupByReceiver(std::vector<Outbound>& batch, std::vector<Group>& groups) {
+        groups.clear();
+        for (Outbound& outbound : batch) {
+            auto it = std::ranges::find(groups, std::string_view(outbound.address), &Group::address);
+            if (it == groups.end())
+                groups.push_back(Group{.address = outbound.address, .messages = {&outbound}});
+            else
+                it->messages.push_back(&outbound);
+        }
+    }
+
+    void sendGroup(Group& group, std::string& buffer) {
+        buffer.clear();
+        std::vector<Outbound*> serialized;
+        serialized.reserve(group.messages.size());
+
+        const bool coalesced = group.messages.size() > 1;
+        if (coalesced)
+            buffer.push_back('[');
+
+        for (Outbound* outbound : group.messages) {
+            if (not serialized.empty())
+                buffer.push_back(',');
+            std::expected status = correspondingAgent->serializer.serializeInto(outbound->message, buffer);
+            if (status.has_value()) {
+                serialized.push_back(outbound);
+            } else {
+                if (not serialized.empty())
+                    buffer.pop_back();
+                correspondingAgent->reportError(status.error(), outbound->message.receiver);
+                outbound->completion->complete(status);
+            }
+        }
+
+        if (serialized.empty())
+            return;
+
+        if (coalesced)
+            buffer.push_back(']');
+
+        std::expected status = correspondingAgent->communicationHandler.send(std::string(group.address), buffer);
+        if (not status.has_value())
+            correspondingAgent->reportError(status.error(), group.address);
+
+        for (Outbound* outbound : serialized)
+            outbound->completion->complete(status);
+    }
+
+    _Agent* correspondingAgent;
+    AsyncSendOptions options;
+
+    std::mutex queueMutex;
+    std::condition_variable_any queueCondition;
+    std::deque<Outbound> queue;
+    bool stopped = false;
+    std::uint64_t nextStreamId = 0;  // used only by sender thread
+
+    std::jthread sender;
+};
+
+}
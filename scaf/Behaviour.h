@@ -1,10 +1,15 @@
 #pragma once
 
+#include "AsyncSender.h"
+#include "ContentStream.h"
 #include "ConversationHandler.h"
 #include "Error.h"
+#include "ResponseCache.h"
 #include "Uid.h"
 
+#include <concepts>
 #include <expected>
+#include <functional>
 
 namespace scaf {
 
@@ -20,7 +25,24 @@ public:
 
     constexpr std::expected<void, Error> handleReceivedMessage(const AclMessage& message) {
         nextReplyWith = message.replyWith;
-        return safeCall([&](){ return handleReceivedMessageImpl(message); });
+        return safeCall([&]() -> std::expected<void, Error> {
+            if (std::optional<ContentChunk> chunk = getContentChunk(message))
+                return handleContentChunkImpl(message, chunk.value());
+            return handleReceivedMessageImpl(message);
+        });
+    }
+
+    // same as handleReceivedMessage, but implementation of _Derived is called directly instead of through vtable,
+    // chunked content still goes through handleContentChunkImpl
+    template <typename _Derived>
+    constexpr std::expected<void, Error> handleReceivedMessageAs(const AclMessage& message) {
+        static_assert(std::derived_from<_Derived, Behaviour>);
+        nextReplyWith = message.replyWith;
+        return safeCall([&]() -> std::expected<void, Error> {
+            if (std::optional<ContentChunk> chunk = getContentChunk(message))
+                return handleContentChunkImpl(message, chunk.value());
+            return static_cast<_Derived&>(*this)._Derived::handleReceivedMessageImpl(message);
+        });
     }
 
     constexpr virtual bool isFinished() = 0;
@@ -32,16 +54,47 @@ protected:
 
     constexpr virtual std::expected<void, Error> handleReceivedMessageImpl(const AclMessage&) = 0;
 
+    // Called for every chunk of content sent with sendMessageChunked. By default whole content, at most
+    // defaultMaxContentSize, is reassembled and passed to handleReceivedMessageImpl, override it to process
+    // content as a stream with memory bounded by chunk size.
+    virtual std::expected<void, Error> handleContentChunkImpl(const AclMessage& message, const ContentChunk& chunk) {
+        std::expected content = reassembler.append(chunk);
+        if (not content.has_value())
+            return std::unexpected(content.error());
+        if (not content->has_value())
+            return {};
+
+        AclMessage complete = message;
+        complete.content = std::move(content->value());
+        return handleReceivedMessageImpl(complete);
+    }
+
     std::expected<void, Error> sendMessage(scaf::AclMessage&& message) {
         message.inReplyTo = std::exchange(nextReplyWith, std::nullopt);
         return agent->sendMessage(*this, std::move(message));
     }
 
+    SendHandle sendMessageAsync(scaf::AclMessage&& message) {
+        message.inReplyTo = std::exchange(nextReplyWith, std::nullopt);
+        return agent->sendMessageAsync(*this, std::move(message));
+    }
+
+    SendHandle sendMessageChunked(scaf::AclMessage&& message, std::size_t chunkSize = defaultChunkSize) {
+        message.inReplyTo = std::exchange(nextReplyWith, std::nullopt);
+        return agent->sendMessageChunked(*this, std::move(message), chunkSize);
+    }
+
+    // for agent with enabled response cache, e.g. when facts cached replies were computed from change
+    std::size_t invalidateCachedResponses(const std::function<bool(const ResponseCacheKey&)>& predicate = nullptr) {
+        return agent->invalidateCachedResponses(predicate);
+    }
+
     template <typename T>
     friend class ConversationHandler;
 
     UniqueConversationId uid;
     std::optional<std::string> nextReplyWith;
+    ContentReassembler reassembler;
     _Agent* agent;
 };
 
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Error.h"
+#include "Performative.h"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace scaf {
+
+template <std::size_t N>
+struct ProtocolName {
+    constexpr ProtocolName(const char (&name)[N]) {
+        std::copy_n(name, N, value);
+    }
+
+    constexpr std::string_view view() const {
+        return std::string_view(value, N - 1);
+    }
+
+    char value[N];
+};
+
+// Behaviour handling conversations started with message of given protocol
+template <typename _Behaviour, ProtocolName _Protocol>
+struct OnProtocol {
+    using Behaviour = _Behaviour;
+
+    static bool matches(const AclMessage& message) {
+        return message.protocol == _Protocol.view();
+    }
+
+    static bool matches(const CompactAclMessage& message) {
+        return message.protocol() == _Protocol.view();
+    }
+};
+
+// Behaviour handling conversations started with given performative
+template <typename _Behaviour, Performative _Performative>
+struct OnPerformative {
+    using Behaviour = _Behaviour;
+
+    static bool matches(const AclMessage& message) {
+        return message.performative == _Performative;
+    }
+
+    static bool matches(const CompactAclMessage& message) {
+        return message.getPerformative() == _Performative;
+    }
+};
+
+// Behaviour handling conversations not matched by previous bindings
+template <typename _Behaviour>
+struct OnAnyConversation {
+    using Behaviour = _Behaviour;
+
+    static bool matches(const AclMessage&) {
+        return true;
+    }
+
+    static bool matches(const CompactAclMessage&) {
+        return true;
+    }
+};
+
+// Behaviour is called by qualified name, so its handlers have to be public
+template <typename _Behaviour>
+concept DirectlyDispatchable = requires(_Behaviour& behaviour, const AclMessage& message) {
+    { behaviour._Behaviour::handleReceivedMessageImpl(message) } -> std::same_as<std::expected<void, Error>>;
+    { behaviour._Behaviour::isFinished() } -> std::same_as<bool>;
+};
+
+// Agent speaking several protocols, e.g. Agent<Behaviours<OnProtocol<Cnp, "fipa-contract-net">, OnPerformative<Query, Performative::query_ref>>, ...>.
+// Behaviour of new conversation is chosen by the first binding matching its first message, conversations started
+// by agent use the first binding unless behaviour is given to createConversation. Messages are dispatched by table
+// generated at compile time, without virtual calls and string comparisons. Binding is matched against received
+// CompactAclMessage, custom bindings have to provide matches for it.
+template <typename... _Bindings>
+class Behaviours {
+    static_assert(sizeof...(_Bindings) > 0, "At least one behaviour has to be bound");
+    using BehaviourTypes = std::tuple<typename _Bindings::Behaviour...>;
+
+public:
+    template <std::size_t I>
+    using BehaviourAt = std::tuple_element_t<I, BehaviourTypes>;
+
+    using Default = BehaviourAt<0>;
+    using Agent = typename Default::Agent;
+    using Conversation = std::variant<std::shared_ptr<typename _Bindings::Behaviour>...>;
+
+    static_assert((std::same_as<typename _Bindings::Behaviour::Agent, Agent> and ...), "All behaviours have to be for the same agent");
+
+    // index of the first binding matching message which starts new conversation
+    template <typename _Message>
+    static std::optional<std::size_t> find(const _Message& message) {
+        std::optional<std::size_t> index;
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            ((_Bindings::matches(message) ? (index = I, true) : false) or ...);
+        }(std::index_sequence_for<_Bindings...>{});
+        return index;
+    }
+
+    template <typename _Behaviour>
+    static constexpr std::size_t indexOf() {
+        constexpr std::array bound{std::same_as<typename _Bindings::Behaviour, _Behaviour>...};
+        static_assert(std::ranges::find(bound, true) != bound.end(), "Behaviour is not bound to agent");
+        return static_cast<std::size_t>(std::ranges::find(bound, true) - bound.begin());
+    }
+
+    // factory is called with std::type_identity of behaviour bound at index
+    template <typename _Factory>
+    static Conversation create(std::size_t index, _Factory&& factory) {
+        return [&]<std::size_t... I>(std::index_sequence<I...>) {
+            using Creator = Conversation (*)(_Factory&);
+            static constexpr std::array<Creator, sizeof...(I)> creators{+[](_Factory& f) {
+                return Conversation(std::in_place_index<I>, f(std::type_identity<BehaviourAt<I>>{}));
+            }...};
+            return creators[index](factory);
+        }(std::index_sequence_for<_Bindings...>{});
+    }
+
+    template <typename _Behaviour>
+    static Conversation wrap(std::shared_ptr<_Behaviour> behaviour) {
+        return Conversation(std::in_place_index<indexOf<_Behaviour>()>, std::move(behaviour));
+    }
+
+    static std::expected<void, Error> handleReceivedMessage(Conversation& conversation, const AclMessage& message) {
+        using Handler = std::expected<void, Error> (*)(Conversation&, const AclMessage&);
+        static constexpr auto handlers = []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Handler, sizeof...(I)>{&handleReceivedMessageAt<I>...};
+        }(std::index_sequence_for<_Bindings...>{});
+        return handlers[conversation.index()](conversation, message);
+    }
+
+    static bool isFinished(Conversation& conversation) {
+        using Check = bool (*)(Conversation&);
+        static constexpr auto checks = []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Check, sizeof...(I)>{&isFinishedAt<I>...};
+        }(std::index_sequence_for<_Bindings...>{});
+        return checks[conversation.index()](conversation);
+    }
+
+private:
+    template <std::size_t I>
+    static std::expected<void, Error> handleReceivedMessageAt(Conversation& conversation, const AclMessage& message) {
+        using Behaviour = BehaviourAt<I>;
+        static_assert(DirectlyDispatchable<Behaviour>, "handleReceivedMessageImpl and isFinished of bound behaviour have to be public");
+        return std::get<I>(conversation)->template handleReceivedMessageAs<Behaviour>(message);
+    }
+
+    template <std::size_t I>
+    static bool isFinishedAt(Conversation& conversation) {
+        using Behaviour = BehaviourAt<I>;
+        return std::get<I>(conversation)->Behaviour::isFinished();
+    }
+};
+
+// Agent with single behaviour, conversations are handled through virtual interface of the behaviour
+template <typename _Behaviour>
+struct SingleBehaviour {
+    using Default = _Behaviour;
+    using Conversation = std::shared_ptr<_Behaviour>;
+
+    template <typename _Message>
+    static std::optional<std::size_t> find(const _Message&) {
+        return 0;
+    }
+
+    template <typename _Factory>
+    static Conversation create(std::size_t, _Factory&& factory) {
+        return factory(std::type_identity<_Behaviour>{});
+    }
+
+    static Conversation wrap(std::shared_ptr<_Behaviour> behaviour) {
+        return behaviour;
+    }
+
+    static std::expected<void, Error> handleReceivedMessage(Conversation& conversation, const AclMessage& message) {
+        return conversation->handleReceivedMessage(message);
+    }
+
+    static bool isFinished(Conversation& conversation) {
+        return conversation->isFinished();
+    }
+};
+
+namespace details {
+    template <typename _Behaviour>
+    struct BehaviourSetOf {
+        using type = SingleBehaviour<_Behaviour>;
+    };
+
+    template <typename... _Bindings>
+    struct BehaviourSetOf<Behaviours<_Bindings...>> {
+        using type = Behaviours<_Bindings...>;
+    };
+}
+
+template <typename _Behaviour>
+using BehaviourSetOf = typename details::BehaviourSetOf<_Behaviour>::type;
+
+}
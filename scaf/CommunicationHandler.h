@@ -1,8 +1,14 @@
 #pragma once
 #include "Error.h"
 
+#include <concepts>
 #include <expected>
+#include <functional>
+#include <memory>
+#include <span>
+#include <streambuf>
 #include <string>
+#include <string_view>
 
 namespace scaf {
 struct Data {
@@ -10,6 +16,23 @@ struct Data {
     std::string data;
 };
 
+// Payload shared by many receivers, complete message is header + *body
+struct SharedData {
+    std::string_view to;
+    std::string_view header;
+    std::shared_ptr<const std::string> body;
+};
+
+// Writes serialized message into stream buffer provided by transport
+using InPlaceSerializer = std::function<std::expected<void, Error>(std::streambuf&)>;
+
+// Transport which lets message to be serialized directly into its own buffers, Agent uses sendInPlace
+// instead of send for such transport
+template <typename T>
+concept InPlaceSending = requires(T handler, const std::string& to, const InPlaceSerializer& serialize) {
+    { handler.sendInPlace(to, serialize) } -> std::same_as<std::expected<void, Error>>;
+};
+
 class CommunicationHandler {
 public:
 
@@ -17,6 +40,21 @@ public:
     virtual std::expected<void, Error> send(const std::string& to, const std::string& data) = 0;
     virtual std::expected<Data, Error> receive() = 0;
     virtual void stop() = 0;
+
+    // Sends whole batch, default implementation falls back to one send per entry.
+    // Transports able to send many messages at once (e.g. writev, sendmmsg) should override it.
+    virtual std::expected<void, Error> sendBatch(std::span<const SharedData> batch) {
+        std::expected<void, Error> status;
+        std::string buffer;
+        for (const SharedData& entry : batch) {
+            buffer.assign(entry.header);
+            buffer.append(*entry.body);
+            std::expected sent = send(std::string(entry.to), buffer);
+            if (not sent.has_value() and status.has_value())
+                status = std::move(sent);
+        }
+        return status;
+    }
 };
 
 }
@@ -0,0 +1,200 @@
+#pragma once
+#include "AclMessage.h"
+#include "Error.h"
+#include "Performative.h"
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace scaf {
+
+struct CompactAclMessageFields {
+    Performative performative;
+    std::string_view sender;
+    std::string_view receiver;
+    std::optional<std::string_view> replyTo = std::nullopt;
+    std::string_view content;  // serialized json
+    std::string_view language;
+    std::string_view encoding;
+    std::optional<std::string_view> ontology = std::nullopt;
+    std::string_view protocol;
+    std::uint64_t conversationId{};
+    std::optional<std::string_view> replyWith = std::nullopt;
+    std::optional<std::string_view> inReplyTo = std::nullopt;
+    std::optional<std::chrono::system_clock::time_point> replyBy = std::nullopt;
+};
+
+// Memory compact, move only equivalent of AclMessage. All strings and serialized content are kept in one
+// buffer allocated at construction, optional fields are marked in presence mask instead of std::optional.
+class CompactAclMessage {
+public:
+    explicit CompactAclMessage(const CompactAclMessageFields& fields)
+        : conversationId(fields.conversationId)
+        , replyByTicks(fields.replyBy.has_value() ? fields.replyBy->time_since_epoch().count() : 0)
+        , performative(fields.performative)
+        , presence(0) {
+        const std::array<std::optional<std::string_view>, fieldCount> values = {
+            fields.sender, fields.receiver, fields.replyTo, fields.content, fields.language,
+            fields.encoding, fields.ontology, fields.protocol, fields.replyWith, fields.inReplyTo,
+        };
+
+        std::size_t size = 0;
+        for (const std::optional<std::string_view>& value : values)
+            size += value.value_or(std::string_view()).size();
+
+        if (size > 0)
+            buffer = std::make_unique_for_overwrite<char[]>(size);
+
+        std::uint32_t end = 0;
+        for (std::size_t i = 0; i < fieldCount; ++i) {
+            if (values[i].has_value()) {
+                presence |= bit(static_cast<Field>(i));
+                if (not values[i]->empty())
+                    std::memcpy(buffer.get() + end, values[i]->data(), values[i]->size());
+                end += static_cast<std::uint32_t>(values[i]->size());
+            }
+            ends[i] = end;
+        }
+        if (fields.replyBy.has_value())
+            presence |= replyByBit;
+    }
+
+    CompactAclMessage(const CompactAclMessage&) = delete;
+    CompactAclMessage& operator=(const CompactAclMessage&) = delete;
+
+    CompactAclMessage(CompactAclMessage&& o) noexcept
+        : buffer(std::move(o.buffer))
+        , conversationId(o.conversationId)
+        , replyByTicks(o.replyByTicks)
+        , ends(std::exchange(o.ends, {}))
+        , performative(o.performative)
+        , presence(std::exchange(o.presence, 0)) {}
+
+    CompactAclMessage& operator=(CompactAclMessage&& o) noexcept {
+        buffer = std::move(o.buffer);
+        conversationId = o.conversationId;
+        replyByTicks = o.replyByTicks;
+        ends = std::exchange(o.ends, {});
+        performative = o.performative;
+        presence = std::exchange(o.presence, 0);
+        return *this;
+    }
+
+    static std::expected<CompactAclMessage, Error> from(const AclMessage& message) {
+        try {
+            return make(message, message.content.dump());
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::serialization_error, e.what()));
+        }
+    }
+
+    // content tree of consumed message is released before compact buffer is allocated
+    static std::expected<CompactAclMessage, Error> from(AclMessage&& message) {
+        try {
+            std::string content = std::exchange(message.content, nullptr).dump();
+            return make(message, content);
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::serialization_error, e.what()));
+        }
+    }
+
+    AclMessage toAclMessage() const {
+        auto toOptional = [](std::optional<std::string_view> value) -> std::optional<std::string> {
+            return value.has_value() ? std::optional<std::string>(std::in_place, *value) : std::nullopt;
+        };
+
+        return AclMessage{
+            .performative = performative,
+            .sender = std::string(sender()),
+            .receiver = std::string(receiver()),
+            .replyTo = toOptional(replyTo()),
+            .content = content(),
+            .language = std::string(language()),
+            .encoding = std::string(encoding()),
+            .ontology = toOptional(ontology()),
+            .protocol = std::string(protocol()),
+            .conversationId = conversationId,
+            .replyWith = toOptional(replyWith()),
+            .inReplyTo = toOptional(inReplyTo()),
+            .replyBy = replyBy(),
+        };
+    }
+
+    Performative getPerformative() const noexcept { return performative; }
+    std::uint64_t getConversationId() const noexcept { return conversationId; }
+    std::string_view sender() const noexcept { return get(Field::sender); }
+    std::string_view receiver() const noexcept { return get(Field::receiver); }
+    std::optional<std::string_view> replyTo() const noexcept { return getOptional(Field::replyTo); }
+    std::string_view contentText() const noexcept { return get(Field::content); }
+    nlohmann::json content() const { return contentText().empty() ? nlohmann::json() : nlohmann::json::parse(contentText()); }
+    std::string_view language() const noexcept { return get(Field::language); }
+    std::string_view encoding() const noexcept { return get(Field::encoding); }
+    std::optional<std::string_view> ontology() const noexcept { return getOptional(Field::ontology); }
+    std::string_view protocol() const noexcept { return get(Field::protocol); }
+    std::optional<std::string_view> replyWith() const noexcept { return getOptional(Field::replyWith); }
+    std::optional<std::string_view> inReplyTo() const noexcept { return getOptional(Field::inReplyTo); }
+
+    std::optional<std::chrono::system_clock::time_point> replyBy() const noexcept {
+        if (not (presence & replyByBit))
+            return std::nullopt;
+        return std::chrono::system_clock::time_point(std::chrono::system_clock::duration(replyByTicks));
+    }
+
+private:
+    enum class Field : std::uint8_t { sender, receiver, replyTo, content, language, encoding, ontology, protocol, replyWith, inReplyTo };
+    static constexpr std::size_t fieldCount = static_cast<std::size_t>(Field::inReplyTo) + 1;
+    static constexpr std::uint16_t replyByBit = 1u << fieldCount;
+
+    static constexpr std::uint16_t bit(Field field) noexcept {
+        return static_cast<std::uint16_t>(1u << static_cast<unsigned>(field));
+    }
+
+    static CompactAclMessage make(const AclMessage& message, std::string_view content) {
+        return CompactAclMessage(CompactAclMessageFields{
+            .performative = message.performative,
+            .sender = message.sender,
+            .receiver = message.receiver,
+            .replyTo = message.replyTo,
+            .content = content,
+            .language = message.language,
+            .encoding = message.encoding,
+            .ontology = message.ontology,
+            .protocol = message.protocol,
+            .conversationId = message.conversationId,
+            .replyWith = message.replyWith,
+            .inReplyTo = message.inReplyTo,
+            .replyBy = message.replyBy,
+        });
+    }
+
+    std::string_view get(Field field) const noexcept {
+        const auto index = static_cast<std::size_t>(field);
+        const std::uint32_t begin = index == 0 ? 0 : ends[index - 1];
+        return std::string_view(buffer.get() + begin, ends[index] - begin);
+    }
+
+    std::optional<std::string_view> getOptional(Field field) const noexcept {
+        if (not (presence & bit(field)))
+            return std::nullopt;
+        return get(field);
+    }
+
+    std::unique_ptr<char[]> buffer;
+    std::uint64_t conversationId;
+    std::chrono::system_clock::rep replyByTicks;
+    std::array<std::uint32_t, fieldCount> ends{};  // end offsets of fields in buffer
+    Performative performative;
+    std::uint16_t presence;
+};
+
+}
@@ -0,0 +1,443 @@
+#pragma once
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Error.h"
+#include "Performative.h"
+#include "utils.h"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Fields of AclMessage in declaration order, which are also keys of its json. Parser below checks at compile
+// time that AclMessage has exactly these fields.
+#define SCAF_ACL_MESSAGE_FIELDS(FIELD) \
+    FIELD(performative) FIELD(sender) FIELD(receiver) FIELD(replyTo) FIELD(content) FIELD(language) FIELD(encoding) \
+    FIELD(ontology) FIELD(protocol) FIELD(conversationId) FIELD(replyWith) FIELD(inReplyTo) FIELD(replyBy)
+#define SCAF_FIELD_ENUMERATOR(name) name,
+#define SCAF_FIELD_KEY(name) #name,
+#define SCAF_FIELD_DESIGNATOR(name) .name = {},
+
+namespace scaf::details {
+
+// Appends string as quoted json string
+inline void appendJsonString(std::string& output, std::string_view value) {
+    output += '"';
+    for (char c : value) {
+        switch (c) {
+        case '"': output += "\\\""; break;
+        case '\\': output += "\\\\"; break;
+        case '\b': output += "\\b"; break;
+        case '\f': output += "\\f"; break;
+        case '\n': output += "\\n"; break;
+        case '\r': output += "\\r"; break;
+        case '\t': output += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                fmt::format_to(std::back_inserter(output), "\\u{:04x}", static_cast<unsigned>(c));
+            else
+                output += c;
+        }
+    }
+    output += '"';
+}
+
+// Builds CompactAclMessage straight from SAX events of json parser, so no json tree and no AclMessage is created.
+// Strings of message are collected in one reused buffer, content is written back to it as compact json text.
+// Accepts single message or array of messages (coalesced by sender into one transport write).
+class CompactMessageParser final : public nlohmann::json_sax<nlohmann::json> {
+public:
+    // only messages with given language and encoding are accepted
+    CompactMessageParser(std::vector<std::expected<CompactAclMessage, Error>>& messages, std::string_view language, std::string_view encoding)
+        : messages(messages), language(language), encoding(encoding) {}
+
+    // error which stopped parsing
+    const std::optional<std::string>& getSyntaxError() const {
+        return syntaxError;
+    }
+
+    bool isBatch() const {
+        return batch;
+    }
+
+    bool null() override {
+        if (region == Region::capture) {
+            separate();
+            text += "null";
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+
+        switch (field) {
+        case Field::replyTo: case Field::ontology: case Field::replyWith: case Field::inReplyTo:
+            ranges[index(field)] = {};
+            return true;
+        case Field::replyBy:
+            replyBy = std::nullopt;
+            return true;
+        default:
+            return invalidType("string");
+        }
+    }
+
+    bool boolean(bool value) override {
+        if (region == Region::capture) {
+            separate();
+            text += value ? "true" : "false";
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+        return invalidType(field == Field::conversationId or field == Field::replyBy ? "number" : "string");
+    }
+
+    bool number_integer(number_integer_t value) override {
+        if (value >= 0)
+            return number_unsigned(static_cast<number_unsigned_t>(value));
+        if (region == Region::capture) {
+            separate();
+            fmt::format_to(std::back_inserter(text), "{}", value);
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+        if (field == Field::replyBy) {
+            replyBy = value;
+            return true;
+        }
+        return invalidType(field == Field::conversationId ? "unsigned number" : "string");
+    }
+
+    bool number_unsigned(number_unsigned_t value) override {
+        if (region == Region::capture) {
+            separate();
+            fmt::format_to(std::back_inserter(text), "{}", value);
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+        if (field == Field::conversationId) {
+            conversationId = value;
+            return true;
+        }
+        if (field == Field::replyBy) {
+            replyBy = static_cast<std::int64_t>(value);
+            return true;
+        }
+        return invalidType("string");
+    }
+
+    bool number_float(number_float_t, const string_t& literal) override {
+        if (region == Region::capture) {
+            separate();
+            text += literal;
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+        return invalidType(field == Field::conversationId or field == Field::replyBy ? "integer" : "string");
+    }
+
+    bool string(string_t& value) override {
+        if (region == Region::capture) {
+            separate();
+            appendJsonString(text, value);
+            return endValue();
+        }
+        if (region == Region::skip)
+            return endValue();
+        if (not messageOpen)
+            return invalidElement();
+
+        switch (field) {
+        case Field::performative:
+            performative = toPerformative(value);
+            return true;
+        case Field::conversationId: case Field::replyBy:
+            return invalidType("number");
+        default:
+            ranges[index(field)] = TextRange{.begin = text.size(), .size = value.size(), .present = true};
+            text += value;
+            return true;
+        }
+    }
+
+    bool binary(binary_t&) override {
+        return false;  // not produced by json text parser
+    }
+
+    bool start_object(std::size_t) override {
+        return startContainer('{');
+    }
+
+    bool key(string_t& name) override {
+        if (region == Region::capture) {
+            separate();
+            appendJsonString(text, name);
+            text += ':';
+            needsSeparator = false;
+            return true;
+        }
+        if (region == Region::skip)
+            return true;
+
+        auto it = std::ranges::find(keys, std::string_view(name));
+        field = static_cast<Field>(it - keys.begin());
+        if (field == Field::unknown) {
+            beginRegion(Region::skip);
+        } else {
+            seen |= 1u << index(field);
+            if (field == Field::content) {
+                beginRegion(Region::capture);
+                ranges[index(Field::content)] = TextRange{.begin = text.size(), .size = 0, .present = true};
+            }
+        }
+        return true;
+    }
+
+    bool end_object() override {
+        return endContainer('}');
+    }
+
+    bool start_array(std::size_t) override {
+        if (depth == 0 and region == Region::none) {
+            batch = true;
+            ++depth;
+            return true;
+        }
+        return startContainer('[');
+    }
+
+    bool end_array() override {
+        if (batch and depth == 1 and region == Region::none) {
+            --depth;
+            return true;
+        }
+        return endContainer(']');
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::json::exception& e) override {
+        syntaxError = e.what();
+        return false;
+    }
+
+private:
+    enum class Field : std::uint8_t { SCAF_ACL_MESSAGE_FIELDS(SCAF_FIELD_ENUMERATOR) unknown };
+    static constexpr std::array keys = std::to_array<std::string_view>({ SCAF_ACL_MESSAGE_FIELDS(SCAF_FIELD_KEY) });
+    static constexpr std::uint16_t allKeys = (1u << keys.size()) - 1;
+
+    // designated initializers fail to compile if listed field is missing or out of order,
+    // structured binding if AclMessage has other fields
+    static_assert(std::is_aggregate_v<AclMessage>);
+    using ListedFieldsInOrder = decltype(AclMessage{ SCAF_ACL_MESSAGE_FIELDS(SCAF_FIELD_DESIGNATOR) });
+    static void checkFieldCount(const AclMessage& message) {
+        static_assert(keys.size() == 13);
+        [[maybe_unused]] const auto& [f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12] = message;
+    }
+
+    // value of key which is written back to text or ignored
+    enum class Region : std::uint8_t { none, capture, skip };
+
+    struct TextRange {
+        std::size_t begin = 0;
+        std::size_t size = 0;
+        bool present = false;
+    };
+
+    static constexpr std::size_t index(Field field) {
+        return static_cast<std::size_t>(field);
+    }
+
+    // unknown name gives the first performative, the same as json conversion of Performative
+    static Performative toPerformative(std::string_view name) {
+        static const std::array<std::string, static_cast<std::size_t>(Performative::subscribe) + 1> names = [] {
+            std::array<std::string, static_cast<std::size_t>(Performative::subscribe) + 1> result;
+            for (std::size_t i = 0; i < result.size(); ++i)
+                result[i] = nlohmann::json(static_cast<Performative>(i)).get<std::string>();
+            return result;
+        }();
+
+        auto it = std::ranges::find(names, name);
+        return it == names.end() ? Performative{} : static_cast<Performative>(it - names.begin());
+    }
+
+    std::size_t messageDepth() const {
+        return batch ? 2 : 1;
+    }
+
+    void beginRegion(Region newRegion) {
+        region = newRegion;
+        regionDepth = depth;
+        needsSeparator = false;
+    }
+
+    // value ended, region ends with value of its key
+    bool endValue() {
+        needsSeparator = true;
+        if (depth == regionDepth) {
+            if (region == Region::capture) {
+                TextRange& content = ranges[index(Field::content)];
+                content.size = text.size() - content.begin;
+            }
+            region = Region::none;
+        }
+        return true;
+    }
+
+    void separate() {
+        if (needsSeparator)
+            text += ',';
+    }
+
+    bool startContainer(char bracket) {
+        if (region == Region::capture) {
+            separate();
+            text += bracket;
+            needsSeparator = false;
+        } else if (region == Region::none) {
+            if (messageOpen) {
+                invalidType("string");
+                beginRegion(Region::skip);
+            } else if (bracket == '{' and depth + 1 == messageDepth()) {
+                beginMessage();
+            } else {
+                invalidElement();
+                beginRegion(Region::skip);
+            }
+        }
+        ++depth;
+        return true;
+    }
+
+    bool endContainer(char bracket) {
+        --depth;
+        if (region == Region::capture)
+            text += bracket;
+        if (region != Region::none)
+            return endValue();
+
+        if (messageOpen and depth + 1 == messageDepth())
+            finishMessage();
+        return true;
+    }
+
+    void beginMessage() {
+        messageOpen = true;
+        text.clear();
+        ranges = {};
+        seen = 0;
+        error.reset();
+        performative = Performative{};
+        conversationId = 0;
+        replyBy = std::nullopt;
+        field = Field::unknown;
+    }
+
+    void finishMessage() {
+        messageOpen = false;
+        if (not error.has_value() and seen != allKeys) {
+            for (std::size_t i = 0; i < keys.size(); ++i) {
+                if (not (seen & (1u << i))) {
+                    error = fmt::format("key '{}' not found", keys[i]);
+                    break;
+                }
+            }
+        }
+        if (error.has_value()) {
+            messages.push_back(std::unexpected(Error(RetCode::deserialization_error, fmt::format("Occured error while deserialization, error: {}", error.value()))));
+            return;
+        }
+
+        using namespace scaf::utils;
+        auto view = [&](Field f) { return std::string_view(text).substr(ranges[index(f)].begin, ranges[index(f)].size); };
+        auto optionalView = [&](Field f) { return ranges[index(f)].present ? std::optional(view(f)) : std::nullopt; };
+
+        if (not compareStringsLowercase(view(Field::language), language)) {
+            messages.push_back(std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid language type. Currently only {} is supported", language))));
+            return;
+        }
+        if (not compareStringsLowercase(view(Field::encoding), encoding)) {
+            messages.push_back(std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid encoding type. Currently only {} is supported", encoding))));
+            return;
+        }
+
+        messages.push_back(CompactAclMessage(CompactAclMessageFields{
+            .performative = performative,
+            .sender = view(Field::sender),
+            .receiver = view(Field::receiver),
+            .replyTo = optionalView(Field::replyTo),
+            .content = view(Field::content),
+            .language = view(Field::language),
+            .encoding = view(Field::encoding),
+            .ontology = optionalView(Field::ontology),
+            .protocol = view(Field::protocol),
+            .conversationId = conversationId,
+            .replyWith = optionalView(Field::replyWith),
+            .inReplyTo = optionalView(Field::inReplyTo),
+            .replyBy = replyBy.has_value() ? std::optional(std::chrono::system_clock::time_point(std::chrono::system_clock::duration(replyBy.value())))
+                                           : std::nullopt,
+        }));
+    }
+
+    bool invalidType(std::string_view expected) {
+        if (not error.has_value())
+            error = fmt::format("type of '{}' has to be {}", keys[index(field)], expected);
+        return true;
+    }
+
+    // top level value or element of batch isn't object
+    bool invalidElement() {
+        messages.push_back(std::unexpected(Error(RetCode::deserialization_error, "Occured error while deserialization, error: message has to be json object")));
+        return true;
+    }
+
+    std::vector<std::expected<CompactAclMessage, Error>>& messages;
+    const std::string_view language;
+    const std::string_view encoding;
+    std::optional<std::string> syntaxError;
+    bool batch = false;
+    std::size_t depth = 0;
+    Region region = Region::none;
+    std::size_t regionDepth = 0;
+    bool needsSeparator = false;
+
+    // message being parsed
+    bool messageOpen = false;
+    Field field = Field::unknown;
+    std::string text;
+    std::array<TextRange, keys.size()> ranges{};
+    std::uint16_t seen = 0;
+    std::optional<std::string> error;
+    Performative performative{};
+    std::uint64_t conversationId = 0;
+    std::optional<std::int64_t> replyBy;
+};
+
+}
+
+#undef SCAF_FIELD_DESIGNATOR
+#undef SCAF_FIELD_KEY
+#undef SCAF_FIELD_ENUMERATOR
+#undef SCAF_ACL_MESSAGE_FIELDS
@@ -0,0 +1,208 @@
+#pragma once
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Error.h"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace scaf {
+
+// Large content sent with sendMessageChunked is split into pieces of serialized json, every piece is sent
+// as separate message with the same header and content {"scaf:chunk": {...}}
+struct ContentChunk {
+    std::uint64_t stream;
+    std::uint64_t offset;
+    std::uint64_t size;  // size of whole serialized content
+    bool last;
+    std::string_view data;
+};
+
+inline constexpr std::string_view contentChunkKey = "scaf:chunk";
+inline constexpr std::size_t defaultChunkSize = 64 * 1024;
+inline constexpr std::uint64_t defaultMaxContentSize = 64 * 1024 * 1024;
+
+// returned chunk refers to content of message
+inline std::optional<ContentChunk> getContentChunk(const AclMessage& message) {
+    if (not message.content.is_object())
+        return std::nullopt;
+
+    auto it = message.content.find(contentChunkKey);
+    if (it == message.content.end() or not it->is_object())
+        return std::nullopt;
+
+    const nlohmann::json& chunk = *it;
+    return ContentChunk{
+        .stream = chunk.at("stream").get<std::uint64_t>(),
+        .offset = chunk.at("offset").get<std::uint64_t>(),
+        .size = chunk.at("size").get<std::uint64_t>(),
+        .last = chunk.at("last").get<bool>(),
+        .data = chunk.at("data").get_ref<const std::string&>(),
+    };
+}
+
+// checks only text of content, so it isn't parsed twice, chunk is read by getContentChunk once message is converted
+inline bool mayBeContentChunk(const CompactAclMessage& message) {
+    return message.contentText().find(fmt::format("\"{}\"", contentChunkKey)) != std::string_view::npos;
+}
+
+inline bool isIntermediateChunk(const AclMessage& message) {
+    std::optional<ContentChunk> chunk = getContentChunk(message);
+    return chunk.has_value() and not chunk->last;
+}
+
+inline nlohmann::json makeChunkContent(const ContentChunk& chunk) {
+    return nlohmann::json{{contentChunkKey, {
+        {"stream", chunk.stream},
+        {"offset", chunk.offset},
+        {"size", chunk.size},
+        {"last", chunk.last},
+        {"data", chunk.data},
+    }}};
+}
+
+namespace details {
+    // size of character in json string, the same escaping as used by nlohmann::json::dump
+    inline std::size_t escapedSize(char c) {
+        switch (c) {
+        case '"': case '\\': case '\b': case '\f': case '\n': case '\r': case '\t':
+            return 2;
+        default:
+            return static_cast<unsigned char>(c) < 0x20 ? 6 : 1;
+        }
+    }
+}
+
+// Splits serialized content into chunks, never in the middle of multi byte UTF-8 character. Chunk size limits
+// data of chunk after it is escaped as json string, so serialized chunk message is at most chunk size plus
+// size of its header. Whole serialized content is kept in memory until the last chunk is taken.
+class ContentSplitter {
+public:
+    ContentSplitter(std::uint64_t stream, std::string&& content, std::size_t chunkSize)
+        : stream(stream), content(std::move(content)), chunkSize(std::max<std::size_t>(chunkSize, 6)) {}
+
+    bool finished() const {
+        return done;
+    }
+
+    ContentChunk next() {
+        std::size_t end = offset;
+        for (std::size_t size = 0; end < content.size(); ++end) {
+            size += details::escapedSize(content[end]);
+            if (size > chunkSize)
+                break;
+        }
+        if (end < content.size()) {
+            while (end > offset and (static_cast<unsigned char>(content[end]) & 0xC0) == 0x80)
+                --end;  // continuation byte
+        }
+
+        ContentChunk chunk{
+            .stream = stream,
+            .offset = offset,
+            .size = content.size(),
+            .last = end == content.size(),
+            .data = std::string_view(content).substr(offset, end - offset),
+        };
+        offset = end;
+        done = chunk.last;
+        return chunk;
+    }
+
+private:
+    std::uint64_t stream;
+    std::string content;
+    std::size_t chunkSize;
+    std::size_t offset = 0;
+    bool done = false;
+};
+
+// Collects chunks of streams of one conversation, complete content is parsed once all its chunks arrived.
+// Chunks can arrive in any order, chunks following the missing one are kept until it arrives. Size announced
+// by sender and all content buffered by reassembler are limited by maxContentSize, stream which breaks the limit
+// or sends inconsistent chunks is dropped.
+class ContentReassembler {
+public:
+    explicit ContentReassembler(std::uint64_t maxContentSize = defaultMaxContentSize) : maxContentSize(maxContentSize) {}
+
+    std::expected<std::optional<nlohmann::json>, Error> append(const ContentChunk& chunk) {
+        if (chunk.size > maxContentSize)
+            return drop(chunk.stream, fmt::format("Content of stream {} has {} bytes, limit is {}", chunk.stream, chunk.size, maxContentSize));
+        if (chunk.offset > chunk.size or chunk.data.size() > chunk.size - chunk.offset)
+            return drop(chunk.stream, fmt::format("Chunk of stream {} at offset {} exceeds content size {}", chunk.stream, chunk.offset, chunk.size));
+
+        auto [it, inserted] = streams.try_emplace(chunk.stream);
+        Stream& stream = it->second;
+        if (inserted)
+            stream.size = chunk.size;
+        if (stream.size != chunk.size or chunk.offset < stream.content.size() or stream.pending.contains(chunk.offset))
+            return drop(chunk.stream, fmt::format("Chunk of stream {} at offset {} doesn't match chunks received before", chunk.stream, chunk.offset));
+        if (buffered + chunk.data.size() > maxContentSize)
+            return drop(chunk.stream, fmt::format("Content buffered for stream {} exceeds limit {}", chunk.stream, maxContentSize));
+
+        buffered += chunk.data.size();
+        if (chunk.offset != stream.content.size()) {
+            stream.pending.emplace(chunk.offset, std::string(chunk.data));
+            return std::nullopt;
+        }
+
+        if (stream.content.empty())
+            stream.content.reserve(stream.size);
+        stream.content.append(chunk.data);
+        while (not stream.pending.empty() and stream.pending.begin()->first <= stream.content.size()) {
+            auto next = stream.pending.extract(stream.pending.begin());
+            if (next.key() != stream.content.size())
+                return drop(chunk.stream, fmt::format("Chunks of stream {} overlap at offset {}", chunk.stream, next.key()));
+            stream.content.append(next.mapped());
+        }
+        if (stream.content.size() < stream.size)
+            return std::nullopt;
+
+        const std::string content = std::move(stream.content);
+        buffered -= content.size();
+        streams.erase(it);
+        try {
+            return nlohmann::json::parse(content);
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Invalid content of stream {}, error: {}", chunk.stream, e.what())));
+        }
+    }
+
+private:
+    struct Stream {
+        std::uint64_t size = 0;
+        std::string content;                          // contiguous beginning of content
+        std::map<std::uint64_t, std::string> pending;  // chunks received ahead of missing one, by offset
+    };
+
+    std::unexpected<Error> drop(std::uint64_t stream, std::string&& message) {
+        discard(stream);
+        return std::unexpected(Error(RetCode::deserialization_error, std::move(message)));
+    }
+
+    void discard(std::uint64_t stream) {
+        auto it = streams.find(stream);
+        if (it == streams.end())
+            return;
+        buffered -= it->second.content.size();
+        for (const auto& [offset, data] : it->second.pending)
+            buffered -= data.size();
+        streams.erase(it);
+    }
+
+    const std::uint64_t maxContentSize;
+    std::uint64_t buffered = 0;  // of all streams
+    std::map<std::uint64_t, Stream> streams;
+};
+
+}
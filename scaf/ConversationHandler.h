@@ -1,11 +1,16 @@
 #pragma once
 
 #include "AclMessage.h"
+#include "BehaviourSet.h"
+#include "CompactAclMessage.h"
+#include "ContentStream.h"
 #include "Error.h"
 #include "SynchronizedMap.h"
 #include "Uid.h"
 #include "utils.h"
 
+#include <fmt/format.h>
+
 #include <atomic>
 #include <cassert>
 #include <expected>
@@ -13,7 +18,9 @@
 #include <limits>
 #include <map>
 #include <memory>
+#include <optional>
 #include <random>
+#include <type_traits>
 #include <utility>
 
 namespace scaf {
@@ -26,47 +33,79 @@ public:
     }
 
 private:
-    using Conversation = _Agent::AgentBehaviour;
+    using AgentBehaviours = BehaviourSetOf<typename _Agent::AgentBehaviour>;
+    using DefaultBehaviour = AgentBehaviours::Default;
+    using Conversation = AgentBehaviours::Conversation;
     friend _Agent;
 
 public:
-    void handleMessage(const AclMessage& message) {
-        UniqueConversationId uid(message.conversationId, message.sender);
+    void handleMessage(const CompactAclMessage& message) {
+        UniqueConversationId uid(message.getConversationId(), std::string(message.sender()));
         if (auto conversation = activeConversations.get(uid)) {
-            handleConversation(uid, **conversation, message);
+            handleConversation(uid, *conversation, message);
+        } else if (std::optional<std::size_t> index = AgentBehaviours::find(message)) {
+            Conversation newConversation = createNewConversation(uid, index.value());
+            handleConversation(uid, newConversation, message);
         } else {
-            std::shared_ptr<Conversation> newConversation = createNewConversation(uid);
-            handleConversation(uid, *newConversation, message);
+            correspondingAgent->reportError(Error(RetCode::generic_error,
+                fmt::format("No behaviour handles conversation {} started with protocol '{}'", uid.conversationId, message.protocol())), uid.sender);
         }
     }
 
-    std::shared_ptr<Conversation> createNewConversation(const decltype(AclMessage::receiver)& receiver) {
+    std::shared_ptr<DefaultBehaviour> createNewConversation(const decltype(AclMessage::receiver)& receiver) {
+        return createNewConversation<DefaultBehaviour>(receiver);
+    }
+
+    template <typename _Behaviour>
+    std::shared_ptr<_Behaviour> createNewConversation(const decltype(AclMessage::receiver)& receiver) {
         UniqueConversationId uid(generateConversationId(), receiver);
-        return createNewConversation(uid);
+        std::shared_ptr<_Behaviour> behaviour = createBehaviour(uid, std::type_identity<_Behaviour>{});
+        activeConversations.emplace(auto{uid}, AgentBehaviours::wrap(behaviour));
+        return behaviour;
     }
 
+    // subscription of the conversation ends with it
     void removeConversation(const UniqueConversationId& uid) {
         activeConversations.erase(uid);
+        correspondingAgent->subscriptionManager.unsubscribe(uid);
     }
 
-    std::shared_ptr<Conversation> getConversation(const UniqueConversationId& uid) {
-        return activeConversations.get(uid).value_or(nullptr);
+    bool hasConversation(const UniqueConversationId& uid) {
+        return activeConversations.contains(uid);
+    }
+
+    Conversation getConversation(const UniqueConversationId& uid) {
+        return activeConversations.get(uid).value_or(Conversation{});
     }
 
 private:
-    std::shared_ptr<Conversation> createNewConversation(const UniqueConversationId& uid) {
-        std::shared_ptr<Conversation> conversation = correspondingAgent->createBehaviour(uid);
+    Conversation createNewConversation(const UniqueConversationId& uid, std::size_t index) {
+        Conversation conversation = AgentBehaviours::create(index, [&]<typename _Behaviour>(std::type_identity<_Behaviour> type) {
+            return createBehaviour(uid, type);
+        });
         return activeConversations.emplace(auto{uid}, std::move(conversation));
     }
 
-    void handleConversation(const UniqueConversationId& uid, Conversation& conversation, const AclMessage& message) {
-        std::expected<void, Error> ret = safeCall([&]{ return conversation.handleReceivedMessage(message); });
+    // default behaviour is created by virtual createBehaviour, so agent can override it
+    template <typename _Behaviour>
+    std::shared_ptr<_Behaviour> createBehaviour(const UniqueConversationId& uid, std::type_identity<_Behaviour>) {
+        if constexpr (std::same_as<_Behaviour, DefaultBehaviour>)
+            return correspondingAgent->createBehaviour(uid);
+        else
+            return correspondingAgent->template createBehaviour<_Behaviour>(uid);
+    }
+
+    // behaviours get complete AclMessage, content is parsed only here
+    void handleConversation(const UniqueConversationId& uid, Conversation& conversation, const CompactAclMessage& received) {
+        const AclMessage message = received.toAclMessage();
+        correspondingAgent->routeSubscription(uid, message);
+        std::expected<void, Error> ret = safeCall([&]{ return AgentBehaviours::handleReceivedMessage(conversation, message); });
 
         if (not ret.has_value()) {      // remove conversation on error
-            correspondingAgent->errorHandler.handle(ret.error());
+            correspondingAgent->reportError(ret.error(), uid.sender);
             removeConversation(uid);
         }
-        if (conversation.isFinished())  // if is finished, also remove conversation
+        if (not isIntermediateChunk(message) and AgentBehaviours::isFinished(conversation))  // if is finished, also remove conversation
             removeConversation(uid);
     }
 
@@ -84,7 +123,7 @@ private:
         conversationIdGenerator = distrib(gen);
     }
 
-    SynchronizedMap<UniqueConversationId, std::shared_ptr<Conversation>> activeConversations;
+    SynchronizedMap<UniqueConversationId, Conversation> activeConversations;
     std::atomic<decltype(AclMessage::conversationId)> conversationIdGenerator;
     _Agent* correspondingAgent;
 };
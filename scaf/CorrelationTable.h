@@ -0,0 +1,304 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Error.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace scaf {
+
+using ReplyCallback = std::function<void(std::expected<AclMessage, Error>&&)>;
+
+// Matches replies (inReplyTo) with requests sent with replyWith. Generated replyWith encodes index of slot
+// in table, so reply is found without any search, replyWith set manually is looked up in hash map.
+// Requests with deadline are expired by separate thread sleeping until the nearest deadline, so callbacks
+// are called even if nothing is received. Deadlines are kept in min-heap, entries of requests completed
+// before their deadline are skipped when they reach top of the heap.
+class CorrelationTable {
+public:
+    using Clock = std::chrono::system_clock;
+
+    CorrelationTable() = default;
+    ~CorrelationTable() {
+        stop();
+    }
+    CorrelationTable(const CorrelationTable&) = delete;
+    CorrelationTable(CorrelationTable&&) = delete;
+
+    // returns replyWith which has to be set in request
+    std::string add(const decltype(AclMessage::receiver)& receiver, ReplyCallback callback, std::optional<Clock::time_point> deadline) {
+        std::scoped_lock guard(accessMutex);
+        std::uint32_t index = allocateSlot(receiver, std::move(callback), deadline);
+        return fmt::format("{}{}.{}", tokenPrefix, index, slots[index].generation);
+    }
+
+    // earlier request with the same replyWith is completed with error, its reply couldn't be told apart
+    void add(const std::string& replyWith, const decltype(AclMessage::receiver)& receiver, ReplyCallback callback, std::optional<Clock::time_point> deadline) {
+        ReplyCallback replaced;
+        {
+            std::scoped_lock guard(accessMutex);
+            if (auto it = foreignTokens.find(replyWith); it != foreignTokens.end()) {
+                replaced = std::move(slots[it->second].callback);
+                releaseSlot(it->second);
+            }
+            std::uint32_t index = allocateSlot(receiver, std::move(callback), deadline);
+            slots[index].foreignToken = replyWith;
+            foreignTokens.insert_or_assign(replyWith, index);
+        }
+        if (replaced)
+            replaced(std::unexpected(Error(RetCode::generic_error, fmt::format("Request with replyWith '{}' was replaced by newer one", replyWith))));
+    }
+
+    // removes request without calling its callback
+    void remove(const std::string& replyWith) {
+        std::scoped_lock guard(accessMutex);
+        if (std::optional<std::uint32_t> index = find(replyWith, std::nullopt))
+            releaseSlot(*index);
+    }
+
+    // calls callback of matching request, returns false if message isn't reply for any active request
+    bool complete(AclMessage&& message) {
+        if (not message.inReplyTo.has_value())
+            return false;
+
+        std::optional<ReplyCallback> callback = take(message.inReplyTo.value(), message.sender);
+        if (not callback.has_value())
+            return false;
+        if (callback.value())
+            callback.value()(std::move(message));
+        return true;
+    }
+
+    // received message is converted to AclMessage only if it is reply
+    bool complete(CompactAclMessage&& message) {
+        if (not message.inReplyTo().has_value())
+            return false;
+
+        std::optional<ReplyCallback> callback = take(message.inReplyTo().value(), message.sender());
+        if (not callback.has_value())
+            return false;
+        if (callback.value())
+            callback.value()(message.toAclMessage());
+        return true;
+    }
+
+    // true if message with inReplyTo from sender is reply for active request, request stays active
+    bool contains(std::string_view inReplyTo, std::string_view sender) {
+        std::scoped_lock guard(accessMutex);
+        return find(inReplyTo, sender).has_value();
+    }
+
+    // calls callback of matching request with error instead of reply
+    bool fail(std::string_view inReplyTo, std::string_view sender, const Error& error) {
+        std::optional<ReplyCallback> callback = take(inReplyTo, sender);
+        if (not callback.has_value())
+            return false;
+        if (callback.value())
+            callback.value()(std::unexpected(error));
+        return true;
+    }
+
+    // removes all requests with passed deadline and calls their callbacks with expired_message error,
+    // only expired requests and already completed ones with passed deadline are visited
+    std::size_t sweepExpired(Clock::time_point now = Clock::now()) {
+        std::vector<ReplyCallback> expired;
+        {
+            std::scoped_lock guard(accessMutex);
+            while (not deadlines.empty() and deadlines.front().deadline <= now) {
+                std::ranges::pop_heap(deadlines, std::greater<>());
+                const Expiry expiry = deadlines.back();
+                deadlines.pop_back();
+
+                Slot& slot = slots[expiry.index];
+                if (not slot.active or slot.generation != expiry.generation)
+                    continue;  // completed or removed before deadline
+                expired.push_back(std::move(slot.callback));
+                releaseSlot(expiry.index);
+            }
+        }
+
+        for (ReplyCallback& callback : expired) {
+            if (callback)
+                callback(std::unexpected(Error(RetCode::expired_message, "No reply received before deadline")));
+        }
+        return expired.size();
+    }
+
+    std::size_t size() {
+        std::scoped_lock guard(accessMutex);
+        return slots.size() - freeSlots.size();
+    }
+
+    // stops expiring requests by deadline, callbacks of remaining requests aren't called
+    void stop() {
+        {
+            std::scoped_lock guard(accessMutex);
+            stopped = true;
+        }
+        if (sweeper.joinable()) {
+            sweeper.request_stop();
+            sweeper.join();
+        }
+    }
+
+private:
+    struct Expiry {
+        Clock::time_point deadline;
+        std::uint32_t index;
+        std::uint32_t generation;
+
+        auto operator<=>(const Expiry&) const = default;
+    };
+
+    struct Slot {
+        std::uint32_t generation = 0;
+        bool active = false;
+        decltype(AclMessage::receiver) receiver;
+        ReplyCallback callback;
+        std::string foreignToken;
+    };
+
+    std::uint32_t allocateSlot(const decltype(AclMessage::receiver)& receiver, ReplyCallback&& callback, std::optional<Clock::time_point> deadline) {
+        std::uint32_t index;
+        if (freeSlots.empty()) {
+            index = static_cast<std::uint32_t>(slots.size());
+            slots.emplace_back();
+        } else {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        Slot& slot = slots[index];
+        slot.active = true;
+        slot.receiver = receiver;
+        slot.callback = std::move(callback);
+        if (deadline.has_value()) {
+            const bool earliest = deadline.value() < nextDeadline();
+            compactDeadlines();
+            deadlines.push_back(Expiry{.deadline = deadline.value(), .index = index, .generation = slot.generation});
+            std::ranges::push_heap(deadlines, std::greater<>());
+            if (earliest) {
+                if (not sweeper.joinable() and not stopped)
+                    sweeper = std::jthread([this](std::stop_token stoken) { sweep(stoken); });
+                deadlineChanged.notify_one();
+            }
+        }
+        return index;
+    }
+
+    Clock::time_point nextDeadline() const {
+        return deadlines.empty() ? Clock::time_point::max() : deadlines.front().deadline;
+    }
+
+    // entries of completed requests are dropped when they outnumber active requests, so heap stays proportional to them
+    void compactDeadlines() {
+        if (deadlines.size() < minCompactedDeadlines or deadlines.size() < 2 * (slots.size() - freeSlots.size()))
+            return;
+        std::erase_if(deadlines, [&](const Expiry& expiry) {
+            return not slots[expiry.index].active or slots[expiry.index].generation != expiry.generation;
+        });
+        std::ranges::make_heap(deadlines, std::greater<>());
+    }
+
+    void sweep(std::stop_token stoken) {
+        std::unique_lock lock(accessMutex);
+        while (true) {
+            const Clock::time_point deadline = nextDeadline();
+            if (deadline == Clock::time_point::max())
+                deadlineChanged.wait(lock, stoken, [&] { return nextDeadline() != deadline; });
+            else
+                deadlineChanged.wait_until(lock, stoken, deadline, [&] { return nextDeadline() < deadline; });
+            if (stoken.stop_requested())
+                return;
+
+            lock.unlock();
+            sweepExpired();
+            lock.lock();
+        }
+    }
+
+    // callback of matching request, the request is removed
+    std::optional<ReplyCallback> take(std::string_view inReplyTo, std::string_view sender) {
+        std::scoped_lock guard(accessMutex);
+        std::optional<std::uint32_t> index = find(inReplyTo, sender);
+        if (not index.has_value())
+            return std::nullopt;
+        ReplyCallback callback = std::move(slots[*index].callback);
+        releaseSlot(*index);
+        return callback;
+    }
+
+    void releaseSlot(std::uint32_t index) {
+        Slot& slot = slots[index];
+        if (not slot.foreignToken.empty()) {
+            foreignTokens.erase(slot.foreignToken);
+            slot.foreignToken.clear();
+        }
+        slot.active = false;
+        slot.callback = nullptr;
+        ++slot.generation;  // invalidates replyWith of released request
+        freeSlots.push_back(index);
+    }
+
+    std::optional<std::uint32_t> find(std::string_view replyWith, std::optional<std::string_view> sender) {
+        std::optional<std::uint32_t> index = replyWith.starts_with(tokenPrefix) ? findGenerated(replyWith.substr(tokenPrefix.size())) : std::nullopt;
+        if (not index.has_value()) {
+            if (auto it = foreignTokens.find(std::string(replyWith)); it != foreignTokens.end())
+                index = it->second;
+        }
+
+        if (index.has_value() and sender.has_value() and slots[*index].receiver != sender.value())
+            return std::nullopt;  // reply from other agent than request was sent to
+        return index;
+    }
+
+    std::optional<std::uint32_t> findGenerated(std::string_view token) {
+        std::uint32_t index = 0;
+        std::uint32_t generation = 0;
+        const char* end = token.data() + token.size();
+
+        auto [separator, indexError] = std::from_chars(token.data(), end, index);
+        if (indexError != std::errc() or separator == end or *separator != '.')
+            return std::nullopt;
+
+        auto [last, generationError] = std::from_chars(separator + 1, end, generation);
+        if (generationError != std::errc() or last != end)
+            return std::nullopt;
+
+        if (index >= slots.size() or not slots[index].active or slots[index].generation != generation or not slots[index].foreignToken.empty())
+            return std::nullopt;
+        return index;
+    }
+
+    static constexpr std::string_view tokenPrefix = "scaf.rw.";
+    static constexpr std::size_t minCompactedDeadlines = 64;
+
+    std::mutex accessMutex;
+    std::vector<Slot> slots;
+    std::vector<std::uint32_t> freeSlots;
+    std::unordered_map<std::string, std::uint32_t> foreignTokens;
+    std::vector<Expiry> deadlines;  // min-heap, the nearest deadline first
+    std::condition_variable_any deadlineChanged;
+    bool stopped = false;
+    std::jthread sweeper;
+};
+
+}
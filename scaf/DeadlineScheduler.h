@@ -0,0 +1,258 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Error.h"
+#include "Performative.h"
+#include "Uid.h"
+#include "utils.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace scaf {
+
+struct DeadlineStatistics {
+    std::uint64_t dispatched;
+    std::uint64_t expired;     // rejected, because replyBy passed before message could be processed
+    std::uint64_t late;        // dispatched after default deadline of its performative
+    std::uint64_t nearMisses;  // dispatched with less than nearMissThreshold before deadline
+    std::uint64_t dropped;     // still pending when scheduler was stopped
+};
+
+struct DeadlineSchedulerOptions {
+    static constexpr std::size_t performativeCount = static_cast<std::size_t>(Performative::subscribe) + 1;
+
+    // deadline relative to receiving time, used for messages without replyBy
+    std::array<std::chrono::milliseconds, performativeCount> defaultDeadlines = makeDefaultDeadlines();
+    std::chrono::milliseconds nearMissThreshold{10};
+
+    void setDefaultDeadline(Performative performative, std::chrono::milliseconds deadline) {
+        defaultDeadlines[static_cast<std::size_t>(performative)] = deadline;
+    }
+
+    static constexpr std::array<std::chrono::milliseconds, performativeCount> makeDefaultDeadlines() {
+        std::array<std::chrono::milliseconds, performativeCount> deadlines;
+        deadlines.fill(std::chrono::seconds(1));
+        for (Performative informative : {Performative::inform, Performative::inform_if, Performative::inform_ref,
+                                         Performative::confirm, Performative::disconfirm, Performative::propagate})
+            deadlines[static_cast<std::size_t>(informative)] = std::chrono::seconds(10);
+        return deadlines;
+    }
+};
+
+// Optional stage between receiving and dispatching of messages. Pending messages are dispatched in order of
+// earliest deadline (replyBy or default deadline of performative), messages with passed replyBy are rejected
+// with expired_message without running behaviour. Messages with equal deadlines keep arrival order.
+// Messages of one conversation are always dispatched in arrival order, so protocol state machines see them
+// as they were sent. Conversation is scheduled by the earliest deadline of its pending messages, so urgent
+// message waiting behind less urgent one of the same conversation speeds up both.
+template <typename _Agent>
+class DeadlineScheduler {
+public:
+    using Clock = std::chrono::system_clock;
+
+    explicit DeadlineScheduler(_Agent* correspondingAgent) : correspondingAgent(correspondingAgent) {}
+
+    ~DeadlineScheduler() {
+        stop();
+    }
+    DeadlineScheduler(const DeadlineScheduler&) = delete;
+    DeadlineScheduler(DeadlineScheduler&&) = delete;
+
+    void enable(const DeadlineSchedulerOptions& newOptions) {
+        std::scoped_lock guard(queueMutex);
+        options = newOptions;
+        if (not dispatcher.joinable())
+            dispatcher = std::jthread([this](std::stop_token stoken) { run(stoken); });
+        enabled = true;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    void push(CompactAclMessage&& message) {
+        const Clock::time_point now = Clock::now();
+        if (message.replyBy().has_value() and message.replyBy().value() <= now) {
+            reject(message);
+            return;
+        }
+
+        {
+            std::scoped_lock guard(queueMutex);
+            const Key key{.deadline = message.replyBy().value_or(now + options.defaultDeadlines[static_cast<std::size_t>(message.getPerformative())]),
+                          .sequence = nextSequence++};
+            UniqueConversationId uid(message.getConversationId(), std::string(message.sender()));
+            auto [it, inserted] = conversations.try_emplace(uid);
+            it->second.messages.push_back(Pending{.key = key, .message = std::move(message)});
+            if (inserted or key < it->second.key)
+                schedule(it->second, key, std::move(uid));
+            ++pendingCount;
+        }
+        pendingCondition.notify_one();
+    }
+
+    // messages which weren't dispatched yet are dropped and reported as one error
+    void stop() {
+        enabled = false;
+        if (dispatcher.joinable()) {
+            dispatcher.request_stop();
+            dispatcher.join();
+        }
+
+        std::size_t dropped = 0;
+        {
+            std::scoped_lock guard(queueMutex);
+            dropped = pendingCount;
+            statistics.dropped += dropped;
+            conversations.clear();
+            scheduled.clear();
+            pendingCount = 0;
+        }
+        if (dropped > 0)
+            correspondingAgent->reportError(Error(RetCode::generic_error, fmt::format("{} received messages dropped, because scheduler was stopped", dropped)));
+    }
+
+    std::size_t size() {
+        std::scoped_lock guard(queueMutex);
+        return pendingCount;
+    }
+
+    DeadlineStatistics getStatistics() {
+        std::scoped_lock guard(queueMutex);
+        return statistics;
+    }
+
+private:
+    struct Key {
+        Clock::time_point deadline;
+        std::uint64_t sequence;  // arrival order
+
+        auto operator<=>(const Key&) const = default;
+    };
+
+    struct Pending {
+        Key key;
+        CompactAclMessage message;
+    };
+
+    struct Conversation {
+        std::deque<Pending> messages;  // in arrival order
+        Key key;                       // the earliest key of messages, its entry in heap is the valid one
+    };
+
+    struct Scheduled {
+        Key key;
+        UniqueConversationId uid;
+
+        bool operator>(const Scheduled& other) const {
+            return key > other.key;
+        }
+    };
+
+    // entry with older key of the conversation stays in heap and is skipped when it gets to the top
+    void schedule(Conversation& conversation, Key key, UniqueConversationId&& uid) {
+        conversation.key = key;
+        scheduled.push_back(Scheduled{.key = key, .uid = std::move(uid)});
+        std::ranges::push_heap(scheduled, std::greater{});
+    }
+
+    // the first message of conversation with the earliest key, has to be called with queueMutex locked
+    std::optional<Pending> takeNext() {
+        while (not scheduled.empty()) {
+            std::ranges::pop_heap(scheduled, std::greater{});
+            Scheduled entry = std::move(scheduled.back());
+            scheduled.pop_back();
+
+            auto it = conversations.find(entry.uid);
+            if (it == conversations.end() or it->second.key != entry.key)
+                continue;
+
+            Conversation& conversation = it->second;
+            Pending next = std::move(conversation.messages.front());
+            conversation.messages.pop_front();
+            --pendingCount;
+            if (conversation.messages.empty())
+                conversations.erase(it);
+            else
+                schedule(conversation, std::ranges::min_element(conversation.messages, {}, &Pending::key)->key, std::move(entry.uid));
+            return next;
+        }
+        return std::nullopt;
+    }
+
+    void run(std::stop_token stoken) {
+        while (true) {
+            std::optional<Pending> next;
+            bool expired = false;
+            {
+                std::unique_lock lock(queueMutex);
+                if (not pendingCondition.wait(lock, stoken, [&] { return pendingCount > 0; }))
+                    return;
+
+                next = takeNext();
+                const Clock::time_point now = Clock::now();
+                const Clock::time_point deadline = next->key.deadline;
+                expired = next->message.replyBy().has_value() and deadline <= now;
+                if (not expired) {
+                    ++statistics.dispatched;
+                    if (deadline <= now)
+                        ++statistics.late;
+                    else if (deadline - now < options.nearMissThreshold)
+                        ++statistics.nearMisses;
+                }
+            }
+
+            if (expired) {
+                reject(next->message);
+                continue;
+            }
+
+            auto ret = safeCall([&] { correspondingAgent->dispatchMessage(std::move(next->message)); });
+            if (not ret.has_value())
+                correspondingAgent->reportError(ret.error());
+        }
+    }
+
+    void reject(const CompactAclMessage& message) {
+        {
+            std::scoped_lock guard(queueMutex);
+            ++statistics.expired;
+        }
+        correspondingAgent->reportError(Error(RetCode::expired_message,
+            fmt::format("Message from {} in conversation {} expired before it was processed", message.sender(), message.getConversationId())), message.sender());
+    }
+
+    _Agent* correspondingAgent;
+    DeadlineSchedulerOptions options;
+    std::atomic_bool enabled = false;
+
+    std::mutex queueMutex;
+    std::condition_variable_any pendingCondition;
+    std::map<UniqueConversationId, Conversation> conversations;
+    std::vector<Scheduled> scheduled;  // min-heap of conversations
+    std::size_t pendingCount = 0;
+    std::uint64_t nextSequence = 0;
+    DeadlineStatistics statistics{};
+
+    std::jthread dispatcher;
+};
+
+}
@@ -5,6 +5,7 @@
 
 namespace scaf {
 
+// Agent never calls handle of its error handler concurrently, even though errors are reported by several threads
 class ErrorHandler {
 public:
     virtual ~ErrorHandler() = default;
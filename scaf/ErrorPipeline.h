@@ -0,0 +1,294 @@
+#pragma once
+#include "Error.h"
+#include "ErrorHandler.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <source_location>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace scaf {
+
+struct ErrorPipelineOptions {
+    std::size_t queueCapacity = 1024;                 // rounded up to power of two, errors are dropped if queue is full
+    std::chrono::milliseconds window{1000};           // deduplication and rate limiting window
+    std::uint32_t maxRepeatsPerWindow = 1;            // errors with the same code, sender and source location passed per window
+    std::uint32_t maxErrorsPerWindow = 100;           // all errors passed per window, one summary of suppressed ones is added
+    std::size_t maxAggregates = 256;                  // kinds of errors tracked per window, errors of other kinds are suppressed
+};
+
+struct ErrorPipelineStatistics {
+    std::uint64_t reported;
+    std::uint64_t forwarded;
+    std::uint64_t suppressed;  // deduplicated or rate limited, summarized at the end of window
+    std::uint64_t dropped;     // queue was full
+};
+
+namespace details {
+    // Fixed size record, so reporting error doesn't allocate. Longer messages and senders are truncated.
+    struct ErrorRecord {
+        RetCode code;
+        std::uint32_t line;
+        const char* file;
+        std::uint8_t senderLength;
+        std::uint8_t messageLength;
+        char sender[46];
+        char message[200];
+
+        std::string_view getSender() const { return std::string_view(sender, senderLength); }
+        std::string_view getMessage() const { return std::string_view(message, messageLength); }
+    };
+
+    // Bounded lock-free queue for many producers and one consumer (D. Vyukov's bounded MPMC queue)
+    class ErrorQueue {
+    public:
+        explicit ErrorQueue(std::size_t capacity)
+            : mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1)
+            , cells(std::make_unique<Cell[]>(mask + 1)) {
+            for (std::size_t i = 0; i <= mask; ++i)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        bool tryPush(const ErrorRecord& record) {
+            std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells[position & mask];
+                const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+                if (difference == 0) {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        cell.record = record;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;  // full
+                } else {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool tryPop(ErrorRecord& record) {
+            Cell& cell = cells[dequeuePosition & mask];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (sequence != dequeuePosition + 1)
+                return false;  // empty
+
+            record = cell.record;
+            cell.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+            ++dequeuePosition;
+            return true;
+        }
+
+        // used only by consumer
+        bool empty() const {
+            return cells[dequeuePosition & mask].sequence.load(std::memory_order_acquire) != dequeuePosition + 1;
+        }
+
+    private:
+        struct alignas(64) Cell {
+            std::atomic<std::size_t> sequence;
+            ErrorRecord record;
+        };
+
+        const std::size_t mask;
+        std::unique_ptr<Cell[]> cells;
+        alignas(64) std::atomic<std::size_t> enqueuePosition = 0;
+        alignas(64) std::size_t dequeuePosition = 0;  // used only by consumer
+    };
+}
+
+// Moves error handling off the message processing threads. Producers only copy compact record into
+// lock-free queue, background thread aggregates errors by code, sender and source location, deduplicates and
+// rate limits them and only then calls ErrorHandler. Messages aren't part of aggregation key, so errors with
+// unique messages can't bypass the limits, message of the first error of every kind is kept as a sample.
+// Suppressed errors are summarized by one error at the end of window. Background thread sleeps until error is
+// reported or window with suppressed errors closes, producers lock mutex to wake it only when it sleeps.
+class ErrorPipeline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ErrorPipeline(ErrorHandler& errorHandler, const ErrorPipelineOptions& options)
+        : errorHandler(errorHandler)
+        , options(options)
+        , queue(options.queueCapacity)
+        , consumer([this](std::stop_token stoken) { run(stoken); }) {}
+
+    ~ErrorPipeline() {
+        stop();
+    }
+    ErrorPipeline(const ErrorPipeline&) = delete;
+    ErrorPipeline(ErrorPipeline&&) = delete;
+
+    // never blocks, if queue is full error is dropped and counted
+    void report(const Error& error, std::string_view sender = {}, std::source_location sl = std::source_location::current()) noexcept {
+        reported.fetch_add(1, std::memory_order_relaxed);
+
+        details::ErrorRecord record;
+        record.code = error.getRetCode();
+        record.line = sl.line();
+        record.file = sl.file_name();
+        record.senderLength = static_cast<std::uint8_t>(std::min(sender.size(), sizeof(record.sender)));
+        std::ranges::copy_n(sender.data(), record.senderLength, record.sender);
+        record.messageLength = static_cast<std::uint8_t>(std::min(error.getMessage().size(), sizeof(record.message)));
+        std::ranges::copy_n(error.getMessage().data(), record.messageLength, record.message);
+
+        if (not queue.tryPush(record)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with fence in run, record or sleeping consumer is seen
+        if (consumerSleeping.load(std::memory_order_relaxed)) {
+            std::scoped_lock guard(wakeMutex);
+            wakeup.notify_one();
+        }
+    }
+
+    // handles everything reported so far and stops background thread
+    void stop() {
+        if (consumer.joinable()) {
+            consumer.request_stop();
+            consumer.join();
+        }
+    }
+
+    ErrorPipelineStatistics getStatistics() const {
+        return ErrorPipelineStatistics{
+            .reported = reported.load(std::memory_order_relaxed),
+            .forwarded = forwarded.load(std::memory_order_relaxed),
+            .suppressed = suppressed.load(std::memory_order_relaxed),
+            .dropped = dropped.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    using Key = std::tuple<RetCode, std::string, std::string_view, std::uint32_t>;  // code, sender, file, line
+
+    struct Aggregate {
+        std::string sample;  // message of the first error
+        std::uint32_t passed = 0;
+        std::uint64_t suppressed = 0;
+    };
+
+    void run(std::stop_token stoken) {
+        while (true) {
+            const bool stopping = stoken.stop_requested();
+            drain();
+            if (stopping or (windowStart.has_value() and Clock::now() - windowStart.value() >= options.window))
+                closeWindow();
+            if (stopping)
+                return;
+
+            std::unique_lock lock(wakeMutex);
+            consumerSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto reported = [&] { return not queue.empty(); };
+            if (std::optional<Clock::time_point> windowEnd = nextWindowEnd())
+                wakeup.wait_until(lock, stoken, windowEnd.value(), reported);
+            else
+                wakeup.wait(lock, stoken, reported);
+            consumerSleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // consumer has to wake up only to summarize suppressed errors, otherwise window is closed by next error
+    std::optional<Clock::time_point> nextWindowEnd() const {
+        if (not windowStart.has_value() or suppressedInWindow == 0)
+            return std::nullopt;
+        return windowStart.value() + options.window;
+    }
+
+    void drain() {
+        details::ErrorRecord record;
+        while (queue.tryPop(record)) {
+            const Clock::time_point now = Clock::now();
+            if (windowStart.has_value() and now - windowStart.value() >= options.window)
+                closeWindow();
+            if (not windowStart.has_value())
+                windowStart = now;
+
+            Key key(record.code, std::string(record.getSender()), record.file, record.line);
+            auto it = aggregates.find(key);
+            if (it == aggregates.end() and aggregates.size() < options.maxAggregates)
+                it = aggregates.emplace(std::move(key), Aggregate{.sample = std::string(record.getMessage())}).first;
+
+            if (it != aggregates.end() and it->second.passed < options.maxRepeatsPerWindow and passedInWindow < options.maxErrorsPerWindow) {
+                ++it->second.passed;
+                ++passedInWindow;
+                forward(Error(record.code, std::string(record.getMessage())));
+                continue;
+            }
+
+            if (it != aggregates.end())
+                ++it->second.suppressed;
+            ++suppressedInWindow;
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // suppressed errors are reported as one error, sample of the most suppressed kind is its message
+    void closeWindow() {
+        auto most = std::ranges::max_element(aggregates, {}, [](const auto& entry) { return entry.second.suppressed; });
+        if (suppressedInWindow > 0 and most != aggregates.end() and most->second.suppressed > 0) {
+            const auto& [code, sender, file, line] = most->first;
+            std::string summary = fmt::format("{} (suppressed {} repeated errors from '{}' reported at {}:{})",
+                                              most->second.sample, most->second.suppressed, sender, file, line);
+            if (const std::uint64_t others = suppressedInWindow - most->second.suppressed; others > 0)
+                summary += fmt::format(", {} other errors suppressed", others);
+            forward(Error(code, std::move(summary)));
+        } else if (suppressedInWindow > 0) {
+            forward(Error(RetCode::generic_error, fmt::format("{} errors of untracked kinds suppressed", suppressedInWindow)));
+        }
+
+        aggregates.clear();
+        windowStart.reset();
+        passedInWindow = 0;
+        suppressedInWindow = 0;
+    }
+
+    void forward(const Error& error) {
+        forwarded.fetch_add(1, std::memory_order_relaxed);
+        errorHandler.handle(error);
+    }
+
+    ErrorHandler& errorHandler;
+    const ErrorPipelineOptions options;
+    details::ErrorQueue queue;
+
+    // used only by consumer
+    std::map<Key, Aggregate> aggregates;
+    std::optional<Clock::time_point> windowStart;  // set by the first error after previous window closed
+    std::uint32_t passedInWindow = 0;
+    std::uint64_t suppressedInWindow = 0;
+
+    std::atomic<std::uint64_t> reported = 0;
+    std::atomic<std::uint64_t> forwarded = 0;
+    std::atomic<std::uint64_t> suppressed = 0;
+    std::atomic<std::uint64_t> dropped = 0;
+
+    std::mutex wakeMutex;
+    std::condition_variable_any wakeup;
+    std::atomic_bool consumerSleeping = false;
+
+    std::jthread consumer;
+};
+
+}
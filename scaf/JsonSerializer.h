@@ -1,6 +1,8 @@
 #pragma once
 
 #include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "CompactMessageParser.h"
 #include "Error.h"
 #include "utils.h"
 
@@ -9,30 +11,69 @@
 
 #include <cctype>
 #include <expected>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <ostream>
 #include <ranges>
 #include <span>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace scaf {
 
+namespace details {
+    // Appends everything written to the stream buffer to string
+    class StringSink : public std::streambuf {
+    public:
+        explicit StringSink(std::string& output) : output(output) {}
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (not traits_type::eq_int_type(c, traits_type::eof()))
+                output.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char_type* s, std::streamsize count) override {
+            output.append(s, static_cast<std::size_t>(count));
+            return count;
+        }
+
+    private:
+        std::string& output;
+    };
+}
+
 class JsonSerializer {
 public:
     std::expected<AclMessage, Error> deserialize(std::span<char> data) {
-        using namespace scaf::utils;
         try {
-            nlohmann::json json = nlohmann::json::parse(data);
-            if (auto it = json.find("language"); it == json.end() or not compareStringsLowercase(it.value().get<std::string>(), language))
-                return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid language type. Currently only {} is supported", language)));
-
-            if (auto it = json.find("encoding"); it == json.end() or not compareStringsLowercase(it.value().get<std::string>(), encoding))
-                return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid encoding type. Currently only {} is supported", encoding)));
-
-            return json.get<AclMessage>();
+            return fromJson(nlohmann::json::parse(data));
         } catch (const std::exception& e) {
             return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Occured error while deserialization, error: {}", e.what())));
         }
     }
 
+    // Parses message directly into its compact form without building json tree
+    std::expected<CompactAclMessage, Error> deserializeCompact(std::span<char> data) {
+        std::vector<std::expected<CompactAclMessage, Error>> messages;
+        bool batch = parseCompact(data, messages);
+        if (batch or messages.size() != 1)
+            return std::unexpected(Error(RetCode::deserialization_error, "Occured error while deserialization, error: single message expected"));
+        return std::move(messages.front());
+    }
+
+    // Accepts single message or array of messages (coalesced by sender into one transport write),
+    // messages are parsed directly into their compact form
+    std::vector<std::expected<CompactAclMessage, Error>> deserializeCompactBatch(std::span<char> data) {
+        std::vector<std::expected<CompactAclMessage, Error>> messages;
+        parseCompact(data, messages);
+        return messages;
+    }
+
     std::expected<std::string, Error> serialize(AclMessage& message) {
         try {
             message.encoding = encoding;
@@ -44,8 +85,107 @@ public:
         }
     }
 
+    // Appends serialized message to output, so the same buffer can be reused for many messages
+    std::expected<void, Error> serializeInto(AclMessage& message, std::string& output) {
+        const std::size_t initialSize = output.size();
+        details::StringSink sink(output);
+        std::expected status = serializeInto(message, static_cast<std::streambuf&>(sink));
+        if (not status.has_value())
+            output.resize(initialSize);
+        return status;
+    }
+
+    // Writes serialized message to stream buffer, errors thrown by the buffer are returned as serialization errors
+    std::expected<void, Error> serializeInto(AclMessage& message, std::streambuf& output) {
+        try {
+            message.encoding = encoding;
+            message.language = language;
+            nlohmann::json json = message;
+            std::ostream stream(&output);
+            stream.exceptions(std::ios::badbit | std::ios::failbit);
+            stream << json;
+            return {};
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::serialization_error, e.what()));
+        }
+    }
+
+    // Serializes message without its per-receiver fields (receiver, conversationId), so result can be shared
+    // by many receivers. Complete payload for given receiver is serializeEnvelope(...) + body.
+    std::expected<std::shared_ptr<const std::string>, Error> serializeShared(AclMessage& message) {
+        return serializeSharedWithout(message, {"receiver", "conversationId"});
+    }
+
+    // Same as serializeShared, but also without inReplyTo, so the same reply can be sent to many requesters.
+    // replyWith and replyBy belong to one requester too, they are cleared, so body has them null.
+    std::expected<std::shared_ptr<const std::string>, Error> serializeSharedReply(AclMessage& message) {
+        message.replyWith = std::nullopt;
+        message.replyBy = std::nullopt;
+        return serializeSharedWithout(message, {"receiver", "conversationId", "inReplyTo"});
+    }
+
+    static std::string serializeEnvelope(std::string_view receiver, decltype(AclMessage::conversationId) conversationId) {
+        return fmt::format(R"({{"conversationId":{},"receiver":{},)", conversationId, nlohmann::json(receiver).dump());
+    }
+
+    // envelope for body from serializeSharedReply, inReplyTo is null if request had no replyWith
+    static std::string serializeEnvelope(std::string_view receiver, decltype(AclMessage::conversationId) conversationId,
+                                         std::optional<std::string_view> inReplyTo) {
+        return fmt::format(R"({{"conversationId":{},"inReplyTo":{},"receiver":{},)", conversationId,
+                           inReplyTo.has_value() ? nlohmann::json(inReplyTo.value()).dump() : "null", nlohmann::json(receiver).dump());
+    }
+
     static inline constexpr std::string encoding = "utf-8";
     static inline constexpr std::string language = "json";
+
+private:
+    std::expected<std::shared_ptr<const std::string>, Error> serializeSharedWithout(AclMessage& message, std::initializer_list<std::string_view> fields) {
+        try {
+            message.encoding = encoding;
+            message.language = language;
+            nlohmann::json json = message;
+            for (std::string_view field : fields)
+                json.erase(std::string(field));
+            std::string body = json.dump();
+            body.erase(0, 1);  // opening brace is part of envelope
+            return std::make_shared<const std::string>(std::move(body));
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::serialization_error, e.what()));
+        }
+    }
+
+    // returns true if data is array of messages
+    static bool parseCompact(std::span<char> data, std::vector<std::expected<CompactAclMessage, Error>>& messages) {
+        try {
+            details::CompactMessageParser parser(messages, language, encoding);
+            if (not nlohmann::json::sax_parse(data.begin(), data.end(), &parser)) {
+                messages.clear();
+                messages.push_back(std::unexpected(Error(RetCode::deserialization_error,
+                    fmt::format("Occured error while deserialization, error: {}", parser.getSyntaxError().value_or("invalid json")))));
+                return false;
+            }
+            return parser.isBatch();
+        } catch (const std::exception& e) {
+            messages.clear();
+            messages.push_back(std::unexpected(Error(RetCode::deserialization_error, fmt::format("Occured error while deserialization, error: {}", e.what()))));
+            return false;
+        }
+    }
+
+    std::expected<AclMessage, Error> fromJson(const nlohmann::json& json) {
+        using namespace scaf::utils;
+        try {
+            if (auto it = json.find("language"); it == json.end() or not compareStringsLowercase(it.value().get<std::string>(), language))
+                return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid language type. Currently only {} is supported", language)));
+
+            if (auto it = json.find("encoding"); it == json.end() or not compareStringsLowercase(it.value().get<std::string>(), encoding))
+                return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Missing or invalid encoding type. Currently only {} is supported", encoding)));
+
+            return json.get<AclMessage>();
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::deserialization_error, fmt::format("Occured error while deserialization, error: {}", e.what())));
+        }
+    }
 };
 
 }
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "CompactAclMessage.h"
+#include "Performative.h"
+#include "Uid.h"
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace scaf {
+
+struct ResponseCacheOptions {
+    std::size_t capacity = 1024;                 // cached responses, the least recently used one is evicted
+    std::chrono::milliseconds timeToLive{1000};
+};
+
+struct ResponseCacheStatistics {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t evictions;      // removed because cache was full
+    std::uint64_t expirations;    // removed because time to live passed
+    std::uint64_t invalidations;  // removed by invalidate
+    std::size_t size;
+};
+
+// Requests with the same performative, protocol, ontology and content (compared as parsed json, so formatting
+// and order of keys doesn't matter) get the same response
+struct ResponseCacheKey {
+    Performative performative;
+    std::string protocol;
+    std::optional<std::string> ontology;
+    nlohmann::json content;
+    std::size_t contentHash;
+};
+
+namespace details {
+    // refers to fields of request, so lookup doesn't copy it
+    struct ResponseCacheKeyView {
+        Performative performative;
+        std::string_view protocol;
+        std::optional<std::string_view> ontology;
+        const nlohmann::json& content;
+        std::size_t contentHash;
+    };
+
+    struct ResponseCacheKeyHash {
+        using is_transparent = void;
+
+        template <typename _Key>
+        std::size_t operator()(const _Key& key) const {
+            std::size_t seed = key.contentHash;
+            for (std::size_t value : {static_cast<std::size_t>(key.performative), std::hash<std::string_view>{}(key.protocol),
+                                      key.ontology ? std::hash<std::string_view>{}(key.ontology.value()) : std::size_t(0)})
+                seed ^= value + 0x9e3779b97f4a7c15u + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+
+    struct ResponseCacheKeyEqual {
+        using is_transparent = void;
+
+        template <typename _First, typename _Second>
+        bool operator()(const _First& first, const _Second& second) const {
+            return first.contentHash == second.contentHash and first.performative == second.performative and
+                   std::string_view(first.protocol) == std::string_view(second.protocol) and
+                   first.ontology == second.ontology and first.content == second.content;
+        }
+    };
+}
+
+// Keeps serialized replies for idempotent requests (query_ref, query_if). Reply body is shared by all requesters,
+// only envelope with receiver, conversationId and inReplyTo is created for each of them. While request is handled
+// by behaviour, its key is remembered for the conversation, so reply sent in the conversation can be cached.
+class ResponseCache {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Body = std::shared_ptr<const std::string>;
+
+    explicit ResponseCache(const ResponseCacheOptions& options) : options(options) {}
+
+    static bool isCacheableRequest(const CompactAclMessage& request) {
+        return request.getPerformative() == Performative::query_ref or request.getPerformative() == Performative::query_if;
+    }
+
+    // reply expecting answer in its conversation isn't cached, its replyWith and replyBy belong to one requester
+    static bool isCacheableReply(const AclMessage& reply) {
+        return (reply.performative == Performative::inform or reply.performative == Performative::inform_if or
+                reply.performative == Performative::inform_ref) and
+               not reply.replyWith.has_value() and not reply.replyBy.has_value();
+    }
+
+    // on miss request is remembered as pending for its conversation
+    std::optional<Body> lookup(const CompactAclMessage& request, Clock::time_point now = Clock::now()) {
+        nlohmann::json content = request.content();
+        const details::ResponseCacheKeyView key{
+            .performative = request.getPerformative(),
+            .protocol = request.protocol(),
+            .ontology = request.ontology(),
+            .content = content,
+            .contentHash = std::hash<nlohmann::json>{}(content),
+        };
+
+        std::scoped_lock guard(accessMutex);
+        if (auto it = entries.find(key); it != entries.end()) {
+            if (it->second.expires > now) {
+                ++hits;
+                recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second.position);
+                return it->second.body;
+            }
+            ++expirations;
+            erase(it);
+        }
+
+        ++misses;
+        UniqueConversationId uid(request.getConversationId(), std::string(request.sender()));
+        if (auto it = pending.find(uid); it != pending.end())
+            erasePending(it);
+        while (not pendingOrder.empty() and pending.size() >= options.capacity)
+            erasePending(pending.find(*pendingOrder.front()));  // the oldest request
+
+        auto [it, inserted] = pending.try_emplace(std::move(uid), PendingRequest{.key = ResponseCacheKey{
+            .performative = key.performative,
+            .protocol = std::string(key.protocol),
+            .ontology = key.ontology.has_value() ? std::optional<std::string>(std::in_place, key.ontology.value()) : std::nullopt,
+            .content = std::move(content),
+            .contentHash = key.contentHash,
+        }, .position = {}});
+        it->second.position = pendingOrder.insert(pendingOrder.end(), &it->first);
+        return std::nullopt;
+    }
+
+    // key of request which started the conversation, if it is waiting for reply
+    std::optional<ResponseCacheKey> takePending(const UniqueConversationId& uid) {
+        std::scoped_lock guard(accessMutex);
+        auto it = pending.find(uid);
+        if (it == pending.end())
+            return std::nullopt;
+        ResponseCacheKey key = std::move(it->second.key);
+        erasePending(it);
+        return key;
+    }
+
+    void insert(ResponseCacheKey&& key, Body body, Clock::time_point now = Clock::now()) {
+        std::scoped_lock guard(accessMutex);
+        if (options.capacity == 0)
+            return;
+
+        if (auto it = entries.find(key); it != entries.end())
+            erase(it);
+        while (entries.size() >= options.capacity) {
+            ++evictions;
+            erase(entries.find(*recentlyUsed.back()));
+        }
+
+        auto [it, inserted] = entries.try_emplace(std::move(key), Entry{.body = std::move(body), .expires = now + options.timeToLive, .position = {}});
+        recentlyUsed.push_front(&it->first);
+        it->second.position = recentlyUsed.begin();
+    }
+
+    // removes responses matching predicate, all responses without predicate
+    std::size_t invalidate(const std::function<bool(const ResponseCacheKey&)>& predicate = nullptr) {
+        std::scoped_lock guard(accessMutex);
+        std::size_t removed = 0;
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (not predicate or predicate(it->first)) {
+                recentlyUsed.erase(it->second.position);
+                it = entries.erase(it);
+                ++removed;
+            } else {
+                ++it;
+            }
+        }
+        invalidations += removed;
+        return removed;
+    }
+
+    ResponseCacheStatistics getStatistics() {
+        std::scoped_lock guard(accessMutex);
+        return ResponseCacheStatistics{
+            .hits = hits,
+            .misses = misses,
+            .evictions = evictions,
+            .expirations = expirations,
+            .invalidations = invalidations,
+            .size = entries.size(),
+        };
+    }
+
+private:
+    struct Entry {
+        Body body;
+        Clock::time_point expires;
+        std::list<const ResponseCacheKey*>::iterator position;  // in recentlyUsed
+    };
+
+    struct PendingRequest {
+        ResponseCacheKey key;
+        std::list<const UniqueConversationId*>::iterator position;  // in pendingOrder
+    };
+
+    using Entries = std::unordered_map<ResponseCacheKey, Entry, details::ResponseCacheKeyHash, details::ResponseCacheKeyEqual>;
+    using PendingRequests = std::map<UniqueConversationId, PendingRequest>;
+
+    void erase(Entries::iterator it) {
+        recentlyUsed.erase(it->second.position);
+        entries.erase(it);
+    }
+
+    void erasePending(PendingRequests::iterator it) {
+        pendingOrder.erase(it->second.position);
+        pending.erase(it);
+    }
+
+    const ResponseCacheOptions options;
+
+    std::mutex accessMutex;
+    Entries entries;
+    std::list<const ResponseCacheKey*> recentlyUsed;  // the most recently used first, keys are owned by entries
+    PendingRequests pending;
+    std::list<const UniqueConversationId*> pendingOrder;  // the oldest request first, keys are owned by pending
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t expirations = 0;
+    std::uint64_t invalidations = 0;
+};
+
+}
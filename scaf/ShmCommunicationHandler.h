@@ -0,0 +1,519 @@
+#pragma once
+#include "CommunicationHandler.h"
+#include "Error.h"
+
+#include <fmt/format.h>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <expected>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace scaf {
+
+struct ShmOptions {
+    std::uint32_t maxPeers = 16;                  // max number of agents sending to this agent
+    std::uint32_t ringCapacity = 1u << 20;        // bytes per sender, has to be power of two
+    std::chrono::milliseconds sendTimeout{1000};  // how long sender waits for free space in full ring
+    std::optional<std::chrono::milliseconds> receiveTimeout = std::nullopt;  // receive fails if no message arrives in time
+};
+
+namespace details::shm {
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free and std::atomic<std::uint32_t>::is_always_lock_free);
+
+    inline constexpr std::uint64_t magic = 0x7363'6166'5f73'686dull;  // "scaf_shm"
+    inline constexpr std::size_t maxNameLength = 111;
+    inline constexpr std::uint32_t lengthSize = sizeof(std::uint32_t);
+
+    enum RingState : std::uint32_t { free, claiming, ready };
+
+    struct alignas(64) SegmentHeader {
+        std::atomic<std::uint64_t> magic;
+        std::uint32_t maxPeers;
+        std::uint32_t ringCapacity;
+        pid_t owner;  // process of receiving agent, segment of dead owner is replaced by new instance
+                      // magic is cleared when owner unlinks segment, so senders attached to it know it's gone
+        alignas(64) std::atomic<std::uint32_t> doorbell;  // futex word, incremented when any ring becomes non-empty
+    };
+
+    struct alignas(64) RingControl {
+        std::atomic<std::uint32_t> state;
+        std::atomic<pid_t> sender;  // process of sending agent, drained ring of dead sender can be claimed again
+        char peer[maxNameLength + 1];
+        alignas(64) std::atomic<std::uint64_t> head;  // written only by receiver
+        std::atomic<std::uint32_t> consumed;          // futex word, incremented when receiver advances head for waiting sender
+        std::atomic<std::uint32_t> senderWaiting;
+        alignas(64) std::atomic<std::uint64_t> tail;  // written only by sender
+    };
+
+    inline std::string segmentName(std::string_view agentName) {
+        std::string name = fmt::format("/scaf.{}", agentName);
+        std::replace(name.begin() + 1, name.end(), '/', '_');
+        return name;
+    }
+
+    inline bool isAlive(pid_t pid) {
+        return pid > 0 and (kill(pid, 0) == 0 or errno == EPERM);
+    }
+
+    inline std::size_t segmentSize(std::uint32_t maxPeers, std::uint32_t ringCapacity) {
+        return sizeof(SegmentHeader) + std::size_t(maxPeers) * (sizeof(RingControl) + ringCapacity);
+    }
+
+    inline void futexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::optional<std::chrono::nanoseconds> timeout = std::nullopt) {
+        timespec relative{};
+        if (timeout.has_value()) {
+            relative.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(timeout.value()).count());
+            relative.tv_nsec = static_cast<long>((timeout.value() % std::chrono::seconds(1)).count());
+        }
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, timeout.has_value() ? &relative : nullptr, nullptr, 0);
+    }
+
+    inline void futexWakeAll(std::atomic<std::uint32_t>& word) {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    // Mapped segment of receiving agent. Layout: header, ring controls, ring data.
+    class Segment {
+    public:
+        Segment(void* address, std::size_t size) : address(address), size(size) {}
+        ~Segment() { munmap(address, size); }
+        Segment(const Segment&) = delete;
+
+        SegmentHeader& header() const { return *static_cast<SegmentHeader*>(address); }
+
+        RingControl& control(std::uint32_t index) const {
+            return reinterpret_cast<RingControl*>(static_cast<std::byte*>(address) + sizeof(SegmentHeader))[index];
+        }
+
+        char* data(std::uint32_t index) const {
+            const SegmentHeader& h = header();
+            return reinterpret_cast<char*>(static_cast<std::byte*>(address) + sizeof(SegmentHeader) + std::size_t(h.maxPeers) * sizeof(RingControl)) +
+                   std::size_t(index) * h.ringCapacity;
+        }
+
+    private:
+        void* address;
+        std::size_t size;
+    };
+
+    inline std::expected<std::unique_ptr<Segment>, Error> map(int fd, std::size_t size) {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("mmap failed: {}", std::strerror(errno))));
+        return std::make_unique<Segment>(address, size);
+    }
+
+    // Copies to and from ring, positions wrap around ring end
+    inline void copyToRing(char* ring, std::uint32_t capacity, std::uint64_t position, const char* source, std::size_t length) {
+        const std::size_t offset = position & (capacity - 1);
+        const std::size_t first = std::min<std::size_t>(length, capacity - offset);
+        std::memcpy(ring + offset, source, first);
+        std::memcpy(ring, source + first, length - first);
+    }
+
+    inline void copyFromRing(const char* ring, std::uint32_t capacity, std::uint64_t position, char* destination, std::size_t length) {
+        const std::size_t offset = position & (capacity - 1);
+        const std::size_t first = std::min<std::size_t>(length, capacity - offset);
+        std::memcpy(destination, ring + offset, first);
+        std::memcpy(destination + first, ring, length - first);
+    }
+
+    // Stream buffer writing serialized message directly into free space of ring, written data becomes visible
+    // to receiver only after commit. Put area covers contiguous free space, so most writes are plain copies.
+    // Throws if ring stays full longer than deadline, so nothing is committed.
+    class RingWriter : public std::streambuf {
+    public:
+        RingWriter(RingControl& control, char* ring, std::uint32_t capacity, std::chrono::steady_clock::time_point deadline)
+            : control(control), ring(ring), capacity(capacity), deadline(deadline)
+            , start(control.tail.load(std::memory_order_relaxed))
+            , position(start)
+            , head(control.head.load(std::memory_order_acquire)) {
+            reserve(lengthSize);
+            position += lengthSize;
+        }
+
+        // publishes message, returns true if ring was empty before
+        bool commit() {
+            advance();
+            const std::uint64_t length = position - start - lengthSize;
+            if (length > UINT32_MAX)
+                throw std::length_error("Message is too large for shared memory ring");
+
+            const auto length32 = static_cast<std::uint32_t>(length);
+            copyToRing(ring, capacity, start, reinterpret_cast<const char*>(&length32), lengthSize);
+            control.tail.store(position, std::memory_order_seq_cst);
+            return control.head.load(std::memory_order_seq_cst) == start;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+                return traits_type::not_eof(c);
+
+            advance();
+            reserve(1);
+            const std::size_t offset = position & (capacity - 1);
+            const std::uint64_t available = std::min({std::uint64_t(capacity - offset), head + capacity - position, start + capacity - position});
+            setp(ring + offset, ring + offset + available);
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+            return c;
+        }
+
+    private:
+        // characters written to put area are added to position
+        void advance() {
+            position += static_cast<std::uint64_t>(pptr() - pbase());
+            setp(nullptr, nullptr);
+        }
+
+        // waits until receiver frees space for length more characters, sleeps on futex advanced by receiver
+        void reserve(std::size_t length) {
+            const std::uint64_t required = position + length;
+            if (required - start > capacity)
+                throw std::length_error("Message is larger than shared memory ring");
+
+            while (required - head > capacity) {
+                const std::uint32_t consumed = control.consumed.load(std::memory_order_seq_cst);
+                control.senderWaiting.store(1, std::memory_order_seq_cst);
+                head = control.head.load(std::memory_order_seq_cst);
+                if (required - head <= capacity)
+                    break;
+
+                const auto remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining <= remaining.zero())
+                    throw std::runtime_error("Timeout while waiting for free space in shared memory ring");
+                futexWait(control.consumed, consumed, remaining);
+                head = control.head.load(std::memory_order_acquire);
+            }
+        }
+
+        RingControl& control;
+        char* ring;
+        const std::uint32_t capacity;
+        const std::chrono::steady_clock::time_point deadline;
+        const std::uint64_t start;
+        std::uint64_t position;
+        std::uint64_t head;
+    };
+}
+
+// Transport for agents running in different processes on the same host. Every agent owns shared memory
+// segment with one single producer single consumer ring per sending agent. Messages are serialized straight
+// into the ring, receiver is woken up with futex only when ring becomes non-empty and sender waiting in full
+// ring only when receiver frees space. Segment of dead agent is replaced by its new instance and ring of dead
+// sender is claimed again by new sender once receiver drained it. Senders attach to segment of restarted agent
+// on their next send, sending to agent which exited fails.
+class ShmCommunicationHandler : public CommunicationHandler {
+public:
+    static std::expected<ShmCommunicationHandler, Error> create(const std::string& name, const ShmOptions& options = {}) {
+        using namespace details::shm;
+        if (name.empty() or name.size() > maxNameLength)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Invalid agent name length: {}", name.size())));
+        if (not std::has_single_bit(options.ringCapacity) or options.ringCapacity < 2 * lengthSize or options.maxPeers == 0)
+            return std::unexpected(Error(RetCode::generic_error, "Ring capacity has to be power of two and max peers can't be 0"));
+
+        const std::string segmentName = details::shm::segmentName(name);
+        int fd = shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 and errno == EEXIST) {
+            std::expected removed = removeStaleSegment(segmentName);
+            if (not removed.has_value())
+                return std::unexpected(removed.error());
+            fd = shm_open(segmentName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+        if (fd < 0)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("shm_open {} failed: {}", segmentName, std::strerror(errno))));
+
+        const std::size_t size = segmentSize(options.maxPeers, options.ringCapacity);
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            Error error(RetCode::generic_error, fmt::format("ftruncate {} failed: {}", segmentName, std::strerror(errno)));
+            close(fd);
+            shm_unlink(segmentName.c_str());
+            return std::unexpected(std::move(error));
+        }
+
+        std::expected segment = map(fd, size);
+        if (not segment.has_value()) {
+            shm_unlink(segmentName.c_str());
+            return std::unexpected(segment.error());
+        }
+
+        SegmentHeader* header = new (&segment.value()->header()) SegmentHeader{};
+        header->maxPeers = options.maxPeers;
+        header->ringCapacity = options.ringCapacity;
+        header->owner = getpid();
+        for (std::uint32_t i = 0; i < options.maxPeers; ++i)
+            new (&segment.value()->control(i)) RingControl{};
+        header->magic.store(magic, std::memory_order_release);
+
+        return ShmCommunicationHandler(name, options, std::move(segment.value()));
+    }
+
+    ShmCommunicationHandler(ShmCommunicationHandler&&) = default;
+
+    ~ShmCommunicationHandler() override {
+        if (state) {
+            state->segment->header().magic.store(0, std::memory_order_release);
+            shm_unlink(details::shm::segmentName(state->name).c_str());
+        }
+    }
+
+    std::expected<void, Error> send(const std::string& to, const std::string& data) override {
+        return sendInPlace(to, [&](std::streambuf& output) -> std::expected<void, Error> {
+            output.sputn(data.data(), static_cast<std::streamsize>(data.size()));
+            return {};
+        });
+    }
+
+    std::expected<void, Error> sendInPlace(const std::string& to, const InPlaceSerializer& serialize) {
+        using namespace details::shm;
+        std::expected<std::shared_ptr<Peer>, Error> peer = getPeer(to);
+        if (not peer.has_value())
+            return std::unexpected(peer.error());
+
+        Segment& segment = *peer.value()->segment;
+        RingControl& control = segment.control(peer.value()->ring);
+        std::scoped_lock guard(peer.value()->sendMutex);
+        try {
+            RingWriter writer(control, segment.data(peer.value()->ring), segment.header().ringCapacity,
+                              std::chrono::steady_clock::now() + state->options.sendTimeout);
+            std::expected status = serialize(writer);
+            if (not status.has_value())
+                return status;
+
+            if (writer.commit()) {
+                segment.header().doorbell.fetch_add(1, std::memory_order_seq_cst);
+                futexWakeAll(segment.header().doorbell);
+            }
+            return {};
+        } catch (const std::exception& e) {
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Sending to {} failed: {}", to, e.what())));
+        }
+    }
+
+    std::expected<Data, Error> receive() override {
+        using namespace details::shm;
+        Segment& segment = *state->segment;
+        SegmentHeader& header = segment.header();
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        if (state->options.receiveTimeout.has_value())
+            deadline = std::chrono::steady_clock::now() + state->options.receiveTimeout.value();
+
+        while (true) {
+            const std::uint32_t doorbell = header.doorbell.load(std::memory_order_seq_cst);
+            if (state->stopped.load())
+                return std::unexpected(Error(RetCode::terminating, "Communication handler was stopped"));
+
+            for (std::uint32_t i = 0; i < header.maxPeers; ++i) {
+                const std::uint32_t index = (state->nextRing + i) % header.maxPeers;
+                RingControl& control = segment.control(index);
+                if (control.state.load(std::memory_order_acquire) != ready)
+                    continue;
+
+                const std::uint64_t head = control.head.load(std::memory_order_relaxed);
+                if (head == control.tail.load(std::memory_order_seq_cst))
+                    continue;
+
+                const char* ring = segment.data(index);
+                std::uint32_t length;
+                copyFromRing(ring, header.ringCapacity, head, reinterpret_cast<char*>(&length), lengthSize);
+
+                Data data{.from = std::string(control.peer, strnlen(control.peer, maxNameLength)), .data = std::string(length, '\0')};
+                copyFromRing(ring, header.ringCapacity, head + lengthSize, data.data.data(), length);
+                control.head.store(head + lengthSize + length, std::memory_order_seq_cst);
+                if (control.senderWaiting.load(std::memory_order_seq_cst) != 0 and control.senderWaiting.exchange(0, std::memory_order_seq_cst) != 0) {
+                    control.consumed.fetch_add(1, std::memory_order_seq_cst);
+                    futexWakeAll(control.consumed);
+                }
+
+                state->nextRing = index + 1;
+                return data;
+            }
+
+            if (not deadline.has_value()) {
+                futexWait(header.doorbell, doorbell);
+                continue;
+            }
+            const auto remaining = deadline.value() - std::chrono::steady_clock::now();
+            if (remaining <= remaining.zero())
+                return std::unexpected(Error(RetCode::generic_error, "No message received before receive timeout"));
+            futexWait(header.doorbell, doorbell, remaining);
+        }
+    }
+
+    void stop() override {
+        state->stopped = true;
+        state->segment->header().doorbell.fetch_add(1, std::memory_order_seq_cst);
+        details::shm::futexWakeAll(state->segment->header().doorbell);
+    }
+
+private:
+    struct Peer {
+        std::unique_ptr<details::shm::Segment> segment;
+        std::uint32_t ring;
+        std::mutex sendMutex;
+    };
+
+    struct State {
+        std::string name;
+        ShmOptions options;
+        std::unique_ptr<details::shm::Segment> segment;
+        std::atomic_bool stopped = false;
+        std::uint32_t nextRing = 0;
+
+        std::mutex peersMutex;
+        std::map<std::string, std::shared_ptr<Peer>, std::less<>> peers;
+    };
+
+    ShmCommunicationHandler(const std::string& name, const ShmOptions& options, std::unique_ptr<details::shm::Segment> segment)
+        : state(std::make_unique<State>()) {
+        state->name = name;
+        state->options = options;
+        state->segment = std::move(segment);
+    }
+
+    // segment left by agent which didn't exit cleanly is removed, segment of running agent is kept
+    static std::expected<void, Error> removeStaleSegment(const std::string& segmentName) {
+        using namespace details::shm;
+        int fd = shm_open(segmentName.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            return errno == ENOENT ? std::expected<void, Error>() :
+                std::unexpected(Error(RetCode::generic_error, fmt::format("shm_open {} failed: {}", segmentName, std::strerror(errno))));
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 or static_cast<std::size_t>(info.st_size) < sizeof(SegmentHeader)) {
+            close(fd);
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Shared memory {} exists, but it isn't initialized", segmentName)));
+        }
+
+        std::expected segment = map(fd, static_cast<std::size_t>(info.st_size));
+        if (not segment.has_value())
+            return std::unexpected(segment.error());
+
+        const SegmentHeader& header = segment.value()->header();
+        if (header.magic.load(std::memory_order_acquire) != magic)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Shared memory {} exists, but it isn't initialized", segmentName)));
+        if (isAlive(header.owner))
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Shared memory {} is used by running process {}", segmentName, header.owner)));
+
+        shm_unlink(segmentName.c_str());
+        return {};
+    }
+
+    // Segment of peer which was unlinked by its owner or whose owner died is dropped and peer is attached again,
+    // so messages aren't written into segment nobody reads. Senders still using dropped segment keep it mapped.
+    std::expected<std::shared_ptr<Peer>, Error> getPeer(const std::string& to) {
+        using namespace details::shm;
+        std::scoped_lock guard(state->peersMutex);
+        if (auto it = state->peers.find(to); it != state->peers.end()) {
+            const SegmentHeader& header = it->second->segment->header();
+            if (header.magic.load(std::memory_order_acquire) == magic and isAlive(header.owner))
+                return it->second;
+            state->peers.erase(it);
+        }
+
+        std::expected peer = attach(to);
+        if (not peer.has_value())
+            return std::unexpected(peer.error());
+        return state->peers.emplace(to, std::move(peer.value())).first->second;
+    }
+
+    std::expected<std::shared_ptr<Peer>, Error> attach(const std::string& to) {
+        using namespace details::shm;
+        const std::string segmentName = details::shm::segmentName(to);
+        int fd = shm_open(segmentName.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Agent {} is not reachable, shm_open failed: {}", to, std::strerror(errno))));
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 or static_cast<std::size_t>(info.st_size) < sizeof(SegmentHeader)) {
+            close(fd);
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Shared memory of agent {} is not initialized", to)));
+        }
+
+        std::expected segment = map(fd, static_cast<std::size_t>(info.st_size));
+        if (not segment.has_value())
+            return std::unexpected(segment.error());
+
+        SegmentHeader& header = segment.value()->header();
+        if (header.magic.load(std::memory_order_acquire) != magic or
+            segmentSize(header.maxPeers, header.ringCapacity) != static_cast<std::size_t>(info.st_size))
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Shared memory of agent {} is not initialized", to)));
+        if (not isAlive(header.owner))
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Agent {} is not running, its process {} exited", to, header.owner)));
+
+        // ring of previous instance of this agent is reused, otherwise first free one is claimed
+        std::optional<std::uint32_t> ring;
+        for (std::uint32_t i = 0; i < header.maxPeers and not ring.has_value(); ++i) {
+            RingControl& control = segment.value()->control(i);
+            if (control.state.load(std::memory_order_acquire) == ready and state->name == control.peer) {
+                control.sender.store(getpid(), std::memory_order_release);
+                ring = i;
+            }
+        }
+        for (std::uint32_t i = 0; i < header.maxPeers and not ring.has_value(); ++i) {
+            std::uint32_t expected = free;
+            if (segment.value()->control(i).state.compare_exchange_strong(expected, claiming, std::memory_order_acq_rel))
+                ring = claim(segment.value()->control(i), i);
+        }
+
+        // ring of dead sender is claimed only after receiver read all its messages, positions in ring are kept
+        for (std::uint32_t i = 0; i < header.maxPeers and not ring.has_value(); ++i) {
+            RingControl& control = segment.value()->control(i);
+            if (control.state.load(std::memory_order_acquire) != ready or isAlive(control.sender.load(std::memory_order_acquire)) or
+                control.head.load(std::memory_order_seq_cst) != control.tail.load(std::memory_order_seq_cst))
+                continue;
+
+            std::uint32_t expected = ready;
+            if (control.state.compare_exchange_strong(expected, claiming, std::memory_order_acq_rel))
+                ring = claim(control, i);
+        }
+
+        if (not ring.has_value())
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Agent {} has no free ring for new sender", to)));
+
+        auto peer = std::make_shared<Peer>();
+        peer->segment = std::move(segment.value());
+        peer->ring = ring.value();
+        return peer;
+    }
+
+    std::uint32_t claim(details::shm::RingControl& control, std::uint32_t index) {
+        std::memcpy(control.peer, state->name.c_str(), state->name.size() + 1);
+        control.sender.store(getpid(), std::memory_order_relaxed);
+        control.state.store(details::shm::ready, std::memory_order_release);
+        return index;
+    }
+
+    std::unique_ptr<State> state;
+};
+
+}
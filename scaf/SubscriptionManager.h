@@ -0,0 +1,251 @@
+#pragma once
+
+#include "AclMessage.h"
+#include "CommunicationHandler.h"
+#include "Error.h"
+#include "Uid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace scaf {
+
+struct SubscriptionStatistics {
+    std::uint64_t published;
+    std::uint64_t delivered;  // passed to transport
+    std::uint64_t failed;     // transport returned error
+    std::uint64_t coalesced;  // notifications replaced by newer ones before being sent to slow subscriber
+};
+
+// Handles subscribe and request_whenever conversations. Notification is serialized once and shared by
+// all subscribers of the topic, sending is done in batches by separate thread, so publisher never waits
+// for transport. If subscriber has not received previous notification yet, it is replaced by the latest one.
+// Subscriber is removed when its conversation ends.
+template <typename _Agent>
+class SubscriptionManager {
+public:
+    using Predicate = std::function<bool(const nlohmann::json&)>;
+
+    explicit SubscriptionManager(_Agent* correspondingAgent, std::size_t maxBatchSize = 64)
+        : correspondingAgent(correspondingAgent)
+        , maxBatchSize(maxBatchSize) {}
+
+    ~SubscriptionManager() {
+        stop();
+    }
+    SubscriptionManager(const SubscriptionManager&) = delete;
+    SubscriptionManager(SubscriptionManager&&) = delete;
+
+    void subscribe(const std::string& topic, const UniqueConversationId& subscriber, std::string address, Predicate predicate = nullptr) {
+        auto subscription = std::make_shared<const Subscription>(Subscription{
+            .id = nextSubscriptionId++,
+            .uid = subscriber,
+            .address = std::move(address),
+            .header = correspondingAgent->serializer.serializeEnvelope(subscriber.sender, subscriber.conversationId),
+            .predicate = std::move(predicate),
+        });
+
+        std::scoped_lock guard(accessMutex);
+        std::vector<std::shared_ptr<const Subscription>>& subscribers = topics[topic];
+        std::erase_if(subscribers, [&](const auto& s) { return s->uid == subscriber; });
+        subscribers.push_back(std::move(subscription));
+        if (std::vector<std::string>& subscribed = topicsOf[subscriber]; std::ranges::find(subscribed, topic) == subscribed.end())
+            subscribed.push_back(topic);
+
+        if (not dispatcher.joinable())
+            dispatcher = std::jthread([this](std::stop_token stoken) { dispatch(stoken); });
+    }
+
+    // notifications not yet sent to the subscriber are dropped
+    void unsubscribe(const std::string& topic, const UniqueConversationId& subscriber) {
+        std::scoped_lock guard(accessMutex);
+        auto subscribed = topicsOf.find(subscriber);
+        if (subscribed == topicsOf.end())
+            return;
+
+        std::erase(subscribed->second, topic);
+        if (subscribed->second.empty())
+            topicsOf.erase(subscribed);
+        removeSubscriptions(topic, subscriber);
+    }
+
+    // called for every ended conversation, only topics of the subscriber are searched
+    void unsubscribe(const UniqueConversationId& subscriber) {
+        std::scoped_lock guard(accessMutex);
+        auto node = topicsOf.extract(subscriber);
+        if (node.empty())
+            return;
+
+        for (const std::string& topic : node.mapped())
+            removeSubscriptions(topic, subscriber);
+    }
+
+    std::expected<void, Error> publish(const std::string& topic, AclMessage&& notification) {
+        std::vector<std::shared_ptr<const Subscription>> receivers;
+        {
+            std::scoped_lock guard(accessMutex);
+            auto it = topics.find(topic);
+            if (it == topics.end())
+                return {};
+            receivers = it->second;
+        }
+
+        std::erase_if(receivers, [&](const auto& s) { return s->predicate and not s->predicate(notification.content); });
+        if (receivers.empty())
+            return {};
+
+        notification.sender = correspondingAgent->name;
+        std::expected body = correspondingAgent->serializer.serializeShared(notification);
+        if (not body.has_value())
+            return std::unexpected(body.error());
+
+        {
+            std::scoped_lock guard(accessMutex);
+            for (std::shared_ptr<const Subscription>& subscription : receivers) {
+                auto [it, inserted] = pending.try_emplace(subscription->id, subscription, body.value());
+                if (not inserted) {
+                    it->second.body = body.value();
+                    ++coalesced;
+                }
+            }
+            ++published;
+        }
+        pendingCondition.notify_one();
+        return {};
+    }
+
+    // Waits until all already published notifications are passed to transport
+    void flush() {
+        std::unique_lock lock(accessMutex);
+        flushedCondition.wait(lock, [&] { return (pending.empty() and not sending) or not dispatcher.joinable(); });
+    }
+
+    void stop() {
+        if (dispatcher.joinable()) {
+            dispatcher.request_stop();
+            dispatcher.join();
+        }
+        flushedCondition.notify_all();
+    }
+
+    std::size_t subscriberCount(const std::string& topic) {
+        std::scoped_lock guard(accessMutex);
+        auto it = topics.find(topic);
+        return it != topics.end() ? it->second.size() : 0u;
+    }
+
+    SubscriptionStatistics getStatistics() {
+        std::scoped_lock guard(accessMutex);
+        return SubscriptionStatistics{.published = published, .delivered = delivered, .failed = failed, .coalesced = coalesced};
+    }
+
+private:
+    struct Subscription {
+        std::uint64_t id;
+        UniqueConversationId uid;
+        std::string address;
+        std::string header;
+        Predicate predicate;
+    };
+
+    struct Notification {
+        Notification(std::shared_ptr<const Subscription> subscription, std::shared_ptr<const std::string> body)
+            : subscription(std::move(subscription)), body(std::move(body)) {}
+
+        std::shared_ptr<const Subscription> subscription;
+        std::shared_ptr<const std::string> body;
+    };
+
+    // has to be called with accessMutex locked
+    void removeSubscriptions(const std::string& topic, const UniqueConversationId& subscriber) {
+        auto it = topics.find(topic);
+        if (it == topics.end())
+            return;
+
+        std::erase_if(it->second, [&](const auto& s) {
+            if (s->uid != subscriber)
+                return false;
+            pending.erase(s->id);
+            return true;
+        });
+        if (it->second.empty())
+            topics.erase(it);
+    }
+
+    void dispatch(std::stop_token stoken) {
+        std::unordered_map<std::uint64_t, Notification> toSend;
+        std::vector<SharedData> batch;
+        batch.reserve(maxBatchSize);
+
+        while (not stoken.stop_requested()) {
+            {
+                std::unique_lock lock(accessMutex);
+                sending = false;
+                flushedCondition.notify_all();
+                if (not pendingCondition.wait(lock, stoken, [&] { return not pending.empty(); }))
+                    return;
+                std::swap(toSend, pending);
+                sending = true;
+            }
+
+            std::uint64_t sent = 0;
+            for (auto it = toSend.begin(); it != toSend.end();) {
+                batch.clear();
+                for (; it != toSend.end() and batch.size() < maxBatchSize; ++it) {
+                    const Notification& notification = it->second;
+                    batch.push_back(SharedData{
+                        .to = notification.subscription->address,
+                        .header = notification.subscription->header,
+                        .body = notification.body,
+                    });
+                }
+
+                std::expected status = correspondingAgent->communicationHandler.sendBatch(batch);
+                if (status.has_value())
+                    sent += batch.size();
+                else
+                    correspondingAgent->reportError(status.error());
+            }
+
+            std::scoped_lock guard(accessMutex);
+            delivered += sent;
+            failed += toSend.size() - sent;
+            toSend.clear();
+        }
+    }
+
+    _Agent* correspondingAgent;
+    const std::size_t maxBatchSize;
+    std::atomic<std::uint64_t> nextSubscriptionId = 0;
+
+    std::mutex accessMutex;
+    std::condition_variable_any pendingCondition;
+    std::condition_variable_any flushedCondition;
+    std::map<std::string, std::vector<std::shared_ptr<const Subscription>>> topics;
+    std::map<UniqueConversationId, std::vector<std::string>> topicsOf;  // topics of every subscriber
+    std::unordered_map<std::uint64_t, Notification> pending;
+    bool sending = false;
+    std::uint64_t published = 0;
+    std::uint64_t delivered = 0;
+    std::uint64_t failed = 0;
+    std::uint64_t coalesced = 0;
+
+    std::jthread dispatcher;
+};
+
+}
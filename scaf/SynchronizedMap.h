@@ -43,6 +43,7 @@ public:
     }
 
     constexpr bool contains(const Key& key) {
+        std::scoped_lock guard(accessMutex);
         return map.contains(key);
     }
 
@@ -0,0 +1,554 @@
+#pragma once
+#include "CommunicationHandler.h"
+#include "Error.h"
+
+#include <fmt/format.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <expected>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace scaf {
+
+struct UdpOptions {
+    std::string address = "127.0.0.1";
+    std::uint16_t port = 0;
+    std::map<std::string, std::string> peers;       // agent name -> "ip:port"
+    std::size_t maxDatagramSize = 1472;             // Ethernet MTU minus IP and UDP headers, larger messages are fragmented
+    std::size_t receiveBatchSize = 32;              // datagrams received with one recvmmsg call
+    int socketBufferSize = 4 * 1024 * 1024;
+    bool reliable = false;                          // sequence numbers, acknowledgements and retransmissions
+    std::chrono::milliseconds retransmitTimeout{50};
+    std::uint32_t maxRetransmits = 20;
+    std::chrono::milliseconds sendTimeout{1000};    // how long sender waits for space in socket send buffer
+};
+
+namespace details::udp {
+    inline constexpr std::uint16_t magic = 0x5343;  // "SC"
+
+    enum class Type : std::uint8_t { data, ack, wakeup };
+
+    // Fields are in host byte order, transport is meant for hosts of the same architecture
+    struct Header {
+        std::uint16_t magic;
+        Type type;
+        std::uint8_t reliable;
+        std::uint32_t messageId;  // per sender and receiver, also sequence number of reliable message
+        std::uint16_t fragmentIndex;
+        std::uint16_t fragmentCount;
+        std::uint32_t session;  // random per handler instance, receiver forgets state of previous instance of sender
+    };
+    static_assert(sizeof(Header) == 16);
+
+    inline std::expected<sockaddr_in, Error> parseAddress(std::string_view address) {
+        const std::size_t separator = address.rfind(':');
+        if (separator == std::string_view::npos)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Address {} has to be in form ip:port", address)));
+
+        sockaddr_in result{};
+        result.sin_family = AF_INET;
+        const std::string ip(address.substr(0, separator));
+        std::uint16_t port = 0;
+        auto [end, error] = std::from_chars(address.data() + separator + 1, address.data() + address.size(), port);
+        if (error != std::errc() or end != address.data() + address.size() or inet_pton(AF_INET, ip.c_str(), &result.sin_addr) != 1)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Invalid address {}", address)));
+
+        result.sin_port = htons(port);
+        return result;
+    }
+
+    inline std::uint64_t addressKey(const sockaddr_in& address) {
+        return (std::uint64_t(address.sin_addr.s_addr) << 16) | address.sin_port;
+    }
+
+    inline std::uint32_t makeSession() {
+        std::random_device random;
+        std::uint32_t session = 0;
+        while (session == 0)
+            session = random();
+        return session;
+    }
+
+    inline std::string toString(const sockaddr_in& address) {
+        char ip[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+        return fmt::format("{}:{}", ip, ntohs(address.sin_port));
+    }
+}
+
+// Datagram transport for latency sensitive agents. Many datagrams are received with one recvmmsg call into
+// preallocated buffers and all fragments (or batch entries) are sent with one sendmmsg call. Messages larger
+// than maxDatagramSize are fragmented, fragments refer directly to data of caller. In reliable mode every message
+// is acknowledged by receiver and retransmitted by sender until acknowledged, duplicates are dropped. Every handler
+// instance sends random session in header, so restarted agent reusing address isn't taken for duplicates of its
+// previous instance. Order of messages is not guaranteed.
+class UdpCommunicationHandler : public CommunicationHandler {
+public:
+    static std::expected<UdpCommunicationHandler, Error> create(const UdpOptions& options) {
+        using namespace details::udp;
+        if (options.maxDatagramSize <= sizeof(Header) or options.receiveBatchSize == 0)
+            return std::unexpected(Error(RetCode::generic_error, "Invalid datagram size or receive batch size"));
+
+        std::expected local = parseAddress(fmt::format("{}:{}", options.address, options.port));
+        if (not local.has_value())
+            return std::unexpected(local.error());
+
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("socket failed: {}", std::strerror(errno))));
+
+        UdpCommunicationHandler handler;
+        handler.state = std::make_unique<State>();
+        handler.state->fd = fd;
+        handler.state->options = options;
+        handler.state->session = makeSession();
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options.socketBufferSize, sizeof(options.socketBufferSize));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options.socketBufferSize, sizeof(options.socketBufferSize));
+        const auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(options.retransmitTimeout);
+        timeval receiveTimeout{.tv_sec = static_cast<time_t>(timeout.count() / 1'000'000), .tv_usec = static_cast<suseconds_t>(timeout.count() % 1'000'000)};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+
+        if (bind(fd, reinterpret_cast<const sockaddr*>(&local.value()), sizeof(sockaddr_in)) != 0)
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("bind {}:{} failed: {}", options.address, options.port, std::strerror(errno))));
+
+        socklen_t length = sizeof(sockaddr_in);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&handler.state->local), &length);
+
+        for (const auto& [name, address] : options.peers) {
+            std::expected peerAddress = parseAddress(address);
+            if (not peerAddress.has_value())
+                return std::unexpected(peerAddress.error());
+            handler.state->addPeer(name, peerAddress.value());
+        }
+
+        const std::size_t batch = options.receiveBatchSize;
+        handler.state->receiveBuffers.resize(batch * options.maxDatagramSize);
+        handler.state->receiveAddresses.resize(batch);
+        handler.state->receiveVectors.resize(batch);
+        handler.state->receiveMessages.resize(batch);
+        for (std::size_t i = 0; i < batch; ++i) {
+            handler.state->receiveVectors[i] = iovec{.iov_base = handler.state->receiveBuffers.data() + i * options.maxDatagramSize, .iov_len = options.maxDatagramSize};
+            handler.state->receiveMessages[i].msg_hdr = msghdr{
+                .msg_name = &handler.state->receiveAddresses[i], .msg_namelen = sizeof(sockaddr_in),
+                .msg_iov = &handler.state->receiveVectors[i], .msg_iovlen = 1,
+                .msg_control = nullptr, .msg_controllen = 0, .msg_flags = 0};
+        }
+        return handler;
+    }
+
+    UdpCommunicationHandler(UdpCommunicationHandler&&) = default;
+
+    ~UdpCommunicationHandler() override {
+        if (state)
+            close(state->fd);
+    }
+
+    // local port, useful when handler was created with port 0
+    std::uint16_t getPort() const {
+        return ntohs(state->local.sin_port);
+    }
+
+    std::expected<void, Error> send(const std::string& to, const std::string& data) override {
+        const SharedData entry{.to = to, .header = data, .body = nullptr};
+        return sendMessages(std::span(&entry, 1));
+    }
+
+    // header and body of entries are sent as separate iovecs, shared body isn't copied
+    std::expected<void, Error> sendBatch(std::span<const SharedData> batch) override {
+        return sendMessages(batch);
+    }
+
+    std::expected<Data, Error> receive() override {
+        while (true) {
+            if (state->stopped.load())
+                return std::unexpected(Error(RetCode::terminating, "Communication handler was stopped"));
+
+            if (not state->ready.empty()) {
+                Data data = std::move(state->ready.front());
+                state->ready.pop_front();
+                return data;
+            }
+
+            std::expected retransmitted = retransmit();
+            if (not retransmitted.has_value())
+                return std::unexpected(retransmitted.error());
+
+            for (std::size_t i = 0; i < state->receiveMessages.size(); ++i)
+                state->receiveMessages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+
+            int received = recvmmsg(state->fd, state->receiveMessages.data(), static_cast<unsigned>(state->receiveMessages.size()), MSG_WAITFORONE, nullptr);
+            if (received < 0) {
+                if (errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR)
+                    continue;  // timeout, time to check retransmissions
+                return std::unexpected(Error(RetCode::generic_error, fmt::format("recvmmsg failed: {}", std::strerror(errno))));
+            }
+
+            std::vector<std::pair<sockaddr_in, details::udp::Header>> acks;
+            for (int i = 0; i < received; ++i)
+                handleDatagram(static_cast<std::size_t>(i), acks);
+            sendAcks(acks);
+        }
+    }
+
+    void stop() override {
+        state->stopped = true;
+        details::udp::Header header{.magic = details::udp::magic, .type = details::udp::Type::wakeup, .reliable = 0,
+                                    .messageId = 0, .fragmentIndex = 0, .fragmentCount = 0, .session = 0};
+        sockaddr_in self = state->local;
+        if (self.sin_addr.s_addr == htonl(INADDR_ANY))
+            self.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sendto(state->fd, &header, sizeof(header), 0, reinterpret_cast<const sockaddr*>(&self), sizeof(self));
+    }
+
+private:
+    struct Unacknowledged {
+        std::string header;
+        std::shared_ptr<const std::string> body;
+        std::chrono::steady_clock::time_point lastSent;
+        std::uint32_t retransmits = 0;
+    };
+
+    struct Partial {
+        std::vector<std::string> fragments;
+        std::uint16_t received = 0;
+        std::uint64_t lastTouched = 0;
+    };
+
+    struct Peer {
+        std::string name;
+        sockaddr_in address{};
+        std::uint32_t nextMessageId = 1;
+        std::map<std::uint32_t, Unacknowledged> unacknowledged;  // guarded by sendMutex
+
+        // used only by receiving thread
+        std::uint32_t session = 0;                  // session of sender whose messages are being received
+        std::vector<std::uint32_t> retiredSessions;  // late datagrams of previous instances are dropped
+        std::map<std::uint32_t, Partial> partial;
+        std::uint64_t touches = 0;                  // orders partial messages by last received fragment
+        std::set<std::uint32_t> delivered;          // recently delivered reliable messages
+    };
+
+    // payload is head followed by body, both refer to caller's data or to unacknowledged message
+    struct Outgoing {
+        std::shared_ptr<Peer> peer;
+        std::uint32_t messageId;
+        std::string_view head;
+        std::string_view body;
+    };
+
+    struct State {
+        int fd = -1;
+        UdpOptions options;
+        std::uint32_t session = 0;
+        sockaddr_in local{};
+        std::atomic_bool stopped = false;
+
+        std::mutex peersMutex;
+        std::map<std::string, std::shared_ptr<Peer>, std::less<>> peersByName;
+        std::map<std::uint64_t, std::shared_ptr<Peer>> peersByAddress;
+        std::mutex sendMutex;
+
+        std::vector<char> receiveBuffers;
+        std::vector<sockaddr_in> receiveAddresses;
+        std::vector<iovec> receiveVectors;
+        std::vector<mmsghdr> receiveMessages;
+        std::deque<Data> ready;
+
+        std::shared_ptr<Peer> addPeer(const std::string& name, const sockaddr_in& address) {
+            auto peer = std::make_shared<Peer>();
+            peer->name = name;
+            peer->address = address;
+            peersByName.insert_or_assign(name, peer);
+            peersByAddress.insert_or_assign(details::udp::addressKey(address), peer);
+            return peer;
+        }
+    };
+
+    static constexpr std::size_t maxPartialMessages = 64;    // per peer, least recently extended incomplete message is dropped
+    static constexpr std::size_t maxDeliveredHistory = 4096;  // per peer, for dropping duplicates
+    static constexpr std::size_t maxRetiredSessions = 8;      // per peer
+
+    UdpCommunicationHandler() = default;
+
+    std::size_t maxPayload() const {
+        return state->options.maxDatagramSize - sizeof(details::udp::Header);
+    }
+
+    // unknown receiver can be given directly as ip:port
+    std::expected<std::shared_ptr<Peer>, Error> getPeer(std::string_view name) {
+        std::scoped_lock guard(state->peersMutex);
+        if (auto it = state->peersByName.find(name); it != state->peersByName.end())
+            return it->second;
+
+        std::expected address = details::udp::parseAddress(name);
+        if (not address.has_value())
+            return std::unexpected(Error(RetCode::generic_error, fmt::format("Unknown agent {}", name)));
+        return state->addPeer(std::string(name), address.value());
+    }
+
+    std::shared_ptr<Peer> getPeer(const sockaddr_in& address) {
+        std::scoped_lock guard(state->peersMutex);
+        if (auto it = state->peersByAddress.find(details::udp::addressKey(address)); it != state->peersByAddress.end())
+            return it->second;
+        return state->addPeer(details::udp::toString(address), address);
+    }
+
+    std::expected<void, Error> sendMessages(std::span<const SharedData> entries) {
+        std::vector<Outgoing> outgoing;
+        outgoing.reserve(entries.size());
+        std::expected<void, Error> status;
+        {
+            std::scoped_lock guard(state->sendMutex);
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                std::expected peer = getPeer(entries[i].to);
+                if (not peer.has_value()) {
+                    status = std::unexpected(peer.error());
+                    continue;
+                }
+
+                const std::uint32_t messageId = peer.value()->nextMessageId++;
+                const std::string_view body = entries[i].body ? std::string_view(*entries[i].body) : std::string_view();
+                if (state->options.reliable)
+                    peer.value()->unacknowledged.insert_or_assign(messageId, Unacknowledged{.header = std::string(entries[i].header), .body = entries[i].body,
+                                                                                            .lastSent = std::chrono::steady_clock::now()});
+                outgoing.push_back(Outgoing{.peer = std::move(peer.value()), .messageId = messageId, .head = entries[i].header, .body = body});
+            }
+        }
+
+        std::expected sent = transmit(outgoing);
+        return sent.has_value() ? status : sent;
+    }
+
+    // every message is split to fragments and all fragments are sent with as few sendmmsg calls as possible,
+    // datagram consists of header and parts of head and body of message, payload isn't copied
+    std::expected<void, Error> transmit(std::span<const Outgoing> outgoing) {
+        using namespace details::udp;
+        const std::size_t payloadSize = maxPayload();
+
+        std::vector<Header> headers;
+        std::vector<const Outgoing*> sources;
+        for (const Outgoing& message : outgoing) {
+            const std::size_t size = message.head.size() + message.body.size();
+            const std::size_t fragments = std::max<std::size_t>(1, (size + payloadSize - 1) / payloadSize);
+            if (fragments > UINT16_MAX)
+                return std::unexpected(Error(RetCode::generic_error, fmt::format("Message of {} bytes is too large for datagram transport", size)));
+
+            for (std::size_t fragment = 0; fragment < fragments; ++fragment) {
+                headers.push_back(Header{.magic = magic, .type = Type::data, .reliable = state->options.reliable,
+                                         .messageId = message.messageId, .fragmentIndex = static_cast<std::uint16_t>(fragment),
+                                         .fragmentCount = static_cast<std::uint16_t>(fragments), .session = state->session});
+                sources.push_back(&message);
+            }
+        }
+
+        constexpr std::size_t maxVectors = 3;  // header, part of head, part of body
+        std::vector<iovec> vectors(headers.size() * maxVectors);
+        std::vector<mmsghdr> messages(headers.size());
+        for (std::size_t i = 0; i < headers.size(); ++i) {
+            const std::size_t begin = std::size_t(headers[i].fragmentIndex) * payloadSize;
+            const std::size_t end = begin + payloadSize;
+            iovec* datagram = &vectors[i * maxVectors];
+            std::size_t count = 0;
+            datagram[count++] = iovec{.iov_base = &headers[i], .iov_len = sizeof(Header)};
+
+            std::size_t partBegin = 0;
+            for (std::string_view part : {sources[i]->head, sources[i]->body}) {
+                const std::size_t first = std::max(begin, partBegin);
+                const std::size_t last = std::min(end, partBegin + part.size());
+                if (first < last)
+                    datagram[count++] = iovec{.iov_base = const_cast<char*>(part.data()) + (first - partBegin), .iov_len = last - first};
+                partBegin += part.size();
+            }
+
+            messages[i].msg_hdr = msghdr{.msg_name = &sources[i]->peer->address, .msg_namelen = sizeof(sockaddr_in),
+                                         .msg_iov = datagram, .msg_iovlen = count, .msg_control = nullptr, .msg_controllen = 0, .msg_flags = 0};
+        }
+        return sendAll(messages);
+    }
+
+    // waits for space in socket send buffer instead of retrying right away
+    std::expected<void, Error> sendAll(std::vector<mmsghdr>& messages) {
+        std::size_t offset = 0;
+        while (offset < messages.size()) {
+            int sent = sendmmsg(state->fd, messages.data() + offset, static_cast<unsigned>(messages.size() - offset), 0);
+            if (sent < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN and errno != EWOULDBLOCK and errno != ENOBUFS)
+                    return std::unexpected(Error(RetCode::generic_error, fmt::format("sendmmsg failed: {}", std::strerror(errno))));
+
+                pollfd writable{.fd = state->fd, .events = POLLOUT, .revents = 0};
+                const int ready = poll(&writable, 1, static_cast<int>(state->options.sendTimeout.count()));
+                if (ready == 0)
+                    return std::unexpected(Error(RetCode::generic_error, "Timeout while waiting for space in socket send buffer"));
+                if (ready < 0 and errno != EINTR)
+                    return std::unexpected(Error(RetCode::generic_error, fmt::format("poll failed: {}", std::strerror(errno))));
+                continue;
+            }
+            offset += static_cast<std::size_t>(sent);
+        }
+        return {};
+    }
+
+    void handleDatagram(std::size_t index, std::vector<std::pair<sockaddr_in, details::udp::Header>>& acks) {
+        using namespace details::udp;
+        const mmsghdr& message = state->receiveMessages[index];
+        const std::size_t length = message.msg_len;
+        if (length < sizeof(Header) or (message.msg_hdr.msg_flags & MSG_TRUNC))
+            return;
+
+        const char* datagram = state->receiveBuffers.data() + index * state->options.maxDatagramSize;
+        Header header;
+        std::memcpy(&header, datagram, sizeof(Header));
+        if (header.magic != magic or header.type == Type::wakeup)
+            return;
+
+        const sockaddr_in& from = state->receiveAddresses[index];
+        std::shared_ptr<Peer> peer = getPeer(from);
+        if (header.type == Type::ack) {
+            if (header.session != state->session)
+                return;  // acknowledgement for previous instance of this agent
+            std::scoped_lock guard(state->sendMutex);
+            peer->unacknowledged.erase(header.messageId);
+            return;
+        }
+
+        if (header.fragmentCount == 0 or header.fragmentIndex >= header.fragmentCount or not acceptSession(*peer, header.session))
+            return;
+
+        std::string_view payload(datagram + sizeof(Header), length - sizeof(Header));
+        std::string data;
+        if (header.fragmentCount == 1) {
+            data.assign(payload);
+        } else {
+            Partial& partial = peer->partial[header.messageId];
+            if (partial.fragments.empty())
+                partial.fragments.resize(header.fragmentCount);
+            if (partial.fragments.size() != header.fragmentCount)
+                return;
+            partial.lastTouched = ++peer->touches;
+
+            std::string& fragment = partial.fragments[header.fragmentIndex];
+            if (fragment.empty() and not payload.empty()) {
+                fragment.assign(payload);
+                ++partial.received;
+            }
+            if (partial.received < header.fragmentCount) {
+                if (peer->partial.size() > maxPartialMessages)
+                    peer->partial.erase(std::ranges::min_element(peer->partial, {}, [](const auto& entry) { return entry.second.lastTouched; }));
+                return;
+            }
+
+            for (const std::string& part : partial.fragments)
+                data.append(part);
+            peer->partial.erase(header.messageId);
+        }
+
+        if (header.reliable) {
+            Header ack = header;
+            ack.type = Type::ack;
+            acks.emplace_back(from, ack);
+            if (not peer->delivered.insert(header.messageId).second)
+                return;  // retransmission of already delivered message
+            if (peer->delivered.size() > maxDeliveredHistory)
+                peer->delivered.erase(peer->delivered.begin());
+        }
+
+        state->ready.push_back(Data{.from = peer->name, .data = std::move(data)});
+    }
+
+    // state of previous instance of sender is forgotten when its new instance starts sending
+    static bool acceptSession(Peer& peer, std::uint32_t session) {
+        if (session == peer.session)
+            return true;
+        if (std::ranges::find(peer.retiredSessions, session) != peer.retiredSessions.end())
+            return false;
+
+        if (peer.session != 0) {
+            peer.retiredSessions.push_back(peer.session);
+            if (peer.retiredSessions.size() > maxRetiredSessions)
+                peer.retiredSessions.erase(peer.retiredSessions.begin());
+        }
+        peer.session = session;
+        peer.partial.clear();
+        peer.delivered.clear();
+        return true;
+    }
+
+    void sendAcks(std::vector<std::pair<sockaddr_in, details::udp::Header>>& acks) {
+        if (acks.empty())
+            return;
+
+        std::vector<iovec> vectors(acks.size());
+        std::vector<mmsghdr> messages(acks.size());
+        for (std::size_t i = 0; i < acks.size(); ++i) {
+            vectors[i] = iovec{.iov_base = &acks[i].second, .iov_len = sizeof(details::udp::Header)};
+            messages[i].msg_hdr = msghdr{.msg_name = &acks[i].first, .msg_namelen = sizeof(sockaddr_in), .msg_iov = &vectors[i],
+                                         .msg_iovlen = 1, .msg_control = nullptr, .msg_controllen = 0, .msg_flags = 0};
+        }
+        sendAll(messages);
+    }
+
+    // called only by receiving thread, which is the only one removing unacknowledged messages
+    std::expected<void, Error> retransmit() {
+        if (not state->options.reliable)
+            return {};
+
+        std::vector<Outgoing> outgoing;
+        std::expected<void, Error> status;
+        {
+            const auto now = std::chrono::steady_clock::now();
+            std::scoped_lock guard(state->sendMutex, state->peersMutex);
+            for (auto& [name, peer] : state->peersByName) {
+                for (auto it = peer->unacknowledged.begin(); it != peer->unacknowledged.end();) {
+                    Unacknowledged& message = it->second;
+                    if (now - message.lastSent < state->options.retransmitTimeout) {
+                        ++it;
+                    } else if (message.retransmits >= state->options.maxRetransmits) {
+                        status = std::unexpected(Error(RetCode::generic_error, fmt::format("Message to {} dropped after {} retransmissions", name, message.retransmits)));
+                        it = peer->unacknowledged.erase(it);
+                    } else {
+                        ++message.retransmits;
+                        message.lastSent = now;
+                        const std::string_view body = message.body ? std::string_view(*message.body) : std::string_view();
+                        outgoing.push_back(Outgoing{.peer = peer, .messageId = it->first, .head = message.header, .body = body});
+                        ++it;
+                    }
+                }
+            }
+        }
+
+        std::expected sent = transmit(outgoing);
+        return status.has_value() ? sent : status;
+    }
+
+    std::unique_ptr<State> state;
+};
+
+}
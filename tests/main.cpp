@@ -1,22 +1,29 @@
 #include <fmt/format.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <chrono>
 #include <concepts>
+#include <future>
 #include <iostream>
 #include <magic_enum.hpp>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <ranges>
 #include <span>
 #include <type_traits>
 #include <unordered_map>
+#include <variant>
 
 #include "Agent.h"
 #include "Behaviour.h"
 #include "JsonSerializer.h"
+#include "ShmCommunicationHandler.h"
+#include "UdpCommunicationHandler.h"
 #include "Uid.h"
 
 template <typename _Agent>
@@ -97,6 +104,215 @@ private:
 };
 
 
+class RecordingCommunicationHandler : public scaf::CommunicationHandler {
+public:
+    std::expected<void, scaf::Error> send(const std::string& to, const std::string& data) override {
+        std::scoped_lock guard(sentMutex);
+        sent.push_back(scaf::Data{.from = to, .data = data});
+        return {};
+    }
+
+    std::expected<scaf::Data, scaf::Error> receive() override {
+        return std::unexpected(scaf::Error(scaf::RetCode::terminating, "nothing to receive"));
+    }
+
+    void stop() override {}
+
+    std::vector<scaf::Data> getSent() {
+        std::scoped_lock guard(sentMutex);
+        return sent;
+    }
+
+private:
+    std::mutex sentMutex;
+    std::vector<scaf::Data> sent;
+};
+
+class RecordingAgent : public scaf::Agent<ResponseWithTemperatureBehaviour<RecordingAgent>, RecordingCommunicationHandler, DefaultErrorHandler> {
+public:
+    explicit RecordingAgent(const std::string& name) : Super(name) {}
+
+    using Super::addSubscriber;
+    using Super::correlationTable;
+    using Super::communicationHandler;
+    using Super::createConversation;
+    using Super::publish;
+    using Super::sendMessageAsync;
+    using Super::sendMessageChunked;
+    using Super::sendRequest;
+    using Super::setAsyncSendOptions;
+    using Super::subscriptionManager;
+
+private:
+    void work() override {}
+};
+
+template <typename _Agent>
+class ContentRecordingBehaviour : public scaf::Behaviour<_Agent> {
+public:
+    explicit ContentRecordingBehaviour(_Agent* agent, scaf::UniqueConversationId uid) : scaf::Behaviour<_Agent>(agent, uid) {}
+
+    std::expected<void, scaf::Error> handleReceivedMessageImpl(const scaf::AclMessage& m) override {
+        this->agent->received.push_back(m.content);
+        return {};
+    }
+
+    bool isFinished() override {
+        return true;
+    }
+};
+
+class ContentRecordingAgent : public scaf::Agent<ContentRecordingBehaviour<ContentRecordingAgent>, RecordingCommunicationHandler, DefaultErrorHandler> {
+public:
+    explicit ContentRecordingAgent(const std::string& name) : Super(name) {}
+
+    std::vector<nlohmann::json> received;
+
+private:
+    void work() override {}
+};
+
+template <typename _Agent>
+class NegotiationBehaviour : public scaf::Behaviour<_Agent> {
+public:
+    explicit NegotiationBehaviour(_Agent* agent, scaf::UniqueConversationId uid) : scaf::Behaviour<_Agent>(agent, uid) {}
+
+    std::expected<void, scaf::Error> handleReceivedMessageImpl(const scaf::AclMessage& m) override {
+        this->agent->handled.emplace_back("negotiation", m.content);
+        finished = m.performative != scaf::Performative::call_for_proposal;
+        return {};
+    }
+
+    bool isFinished() override {
+        return finished;
+    }
+
+private:
+    bool finished = false;
+};
+
+template <typename _Agent>
+class QueryBehaviour : public scaf::Behaviour<_Agent> {
+public:
+    explicit QueryBehaviour(_Agent* agent, scaf::UniqueConversationId uid) : scaf::Behaviour<_Agent>(agent, uid) {}
+
+    std::expected<void, scaf::Error> handleReceivedMessageImpl(const scaf::AclMessage& m) override {
+        this->agent->handled.emplace_back("query", m.content);
+        return {};
+    }
+
+    bool isFinished() override {
+        return true;
+    }
+};
+
+class MultiProtocolAgent : public scaf::Agent<scaf::Behaviours<scaf::OnProtocol<NegotiationBehaviour<MultiProtocolAgent>, "fipa-contract-net">,
+                                                                scaf::OnPerformative<QueryBehaviour<MultiProtocolAgent>, scaf::Performative::query_ref>>,
+                                              RecordingCommunicationHandler, DefaultErrorHandler> {
+public:
+    explicit MultiProtocolAgent(const std::string& name) : Super(name) {}
+
+    using Super::conversationHandler;
+    using Super::createConversation;
+
+    std::vector<std::pair<std::string, nlohmann::json>> handled;
+
+private:
+    void work() override {}
+};
+
+template <typename _Agent>
+class PriceQueryBehaviour : public scaf::Behaviour<_Agent> {
+public:
+    explicit PriceQueryBehaviour(_Agent* agent, scaf::UniqueConversationId uid) : scaf::Behaviour<_Agent>(agent, uid) {}
+
+    std::expected<void, scaf::Error> handleReceivedMessageImpl(const scaf::AclMessage& m) override {
+        ++this->agent->computed;
+        finished = m.performative != scaf::Performative::request;  // request keeps conversation running
+        if (m.performative == scaf::Performative::inform) {  // price changed
+            this->invalidateCachedResponses();
+            return {};
+        }
+        if (not finished)
+            return {};
+        return this->sendMessage(scaf::AclMessageBuilder{.performative = scaf::Performative::inform_ref, .content = 100 + this->agent->computed, .protocol = m.protocol});
+    }
+
+    bool isFinished() override {
+        return finished;
+    }
+
+private:
+    bool finished = false;
+};
+
+class CachingAgent : public scaf::Agent<PriceQueryBehaviour<CachingAgent>, RecordingCommunicationHandler, DefaultErrorHandler> {
+public:
+    explicit CachingAgent(const std::string& name) : Super(name) {}
+
+    using Super::communicationHandler;
+
+    int computed = 0;
+
+private:
+    void work() override {}
+};
+
+// subscription to topic "secret" is refused, other ones last until cancel
+template <typename _Agent>
+class SubscriptionBehaviour : public scaf::Behaviour<_Agent> {
+public:
+    explicit SubscriptionBehaviour(_Agent* agent, scaf::UniqueConversationId uid) : scaf::Behaviour<_Agent>(agent, uid) {}
+
+    std::expected<void, scaf::Error> handleReceivedMessageImpl(const scaf::AclMessage& m) override {
+        finished = m.performative == scaf::Performative::cancel or m.content == "secret";
+        return {};
+    }
+
+    bool isFinished() override {
+        return finished;
+    }
+
+private:
+    bool finished = false;
+};
+
+class SubscribingAgent : public scaf::Agent<SubscriptionBehaviour<SubscribingAgent>, RecordingCommunicationHandler, DefaultErrorHandler> {
+public:
+    explicit SubscribingAgent(const std::string& name) : Super(name) {}
+
+    using Super::subscriptionManager;
+
+private:
+    void work() override {}
+};
+
+// message as received by agent from transport
+scaf::AclMessage makeReceivedMessage(scaf::Performative performative, const std::string& sender, const std::string& protocol,
+                                     std::uint64_t conversationId, nlohmann::json content, std::optional<std::string> replyWith = std::nullopt) {
+    return scaf::AclMessage{.performative = performative, .sender = sender, .receiver = "agent", .content = std::move(content),
+                            .language = scaf::JsonSerializer::language, .encoding = scaf::JsonSerializer::encoding,
+                            .protocol = protocol, .conversationId = conversationId, .replyWith = std::move(replyWith)};
+}
+
+template <typename _Agent>
+void deliver(_Agent& agent, const scaf::AclMessage& message) {
+    agent.handleData(scaf::Data{.from = message.sender, .data = nlohmann::json(message).dump()});
+}
+
+// polls predicate of work done by other thread, so regression fails the test instead of hanging it
+template <typename _Predicate>
+bool waitUntil(_Predicate predicate, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (not predicate()) {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+
 std::function<void(std::string)> handler = nullptr;
 
 void event() {
@@ -177,9 +393,708 @@ void testJsonSerialization() {
     }
 }
 
+void testCompactAclMessage() {
+    using namespace scaf;
+
+    AclMessage message{
+        .performative = Performative::propose,
+        .sender = "sender",
+        .receiver = "receiver",
+        .replyTo = std::nullopt,
+        .content = {{"price", 12.5}, {"item", "steel"}},
+        .language = "json",
+        .encoding = "utf-8",
+        .ontology = "",
+        .protocol = "CNP",
+        .conversationId = 1234567890u,
+        .replyWith = "replyWith",
+        .inReplyTo = std::nullopt,
+        .replyBy = std::chrono::system_clock::now()
+    };
+
+    std::expected<CompactAclMessage, Error> compact = CompactAclMessage::from(message);
+    assert(compact.has_value());
+    assert(compact->sender() == "sender");
+    assert(not compact->replyTo().has_value());
+    assert(compact->ontology() == "");
+    assert(compact->replyWith() == "replyWith");
+
+    CompactAclMessage moved = std::move(compact.value());
+    assert(moved.toAclMessage() == message);
+
+    JsonSerializer serializer;
+    std::string data = serializer.serialize(message).value();
+    std::expected<CompactAclMessage, Error> deserialized = serializer.deserializeCompact(data);
+    assert(deserialized.has_value());
+    assert(deserialized->toAclMessage() == message);
+
+    // content keeps its text, other keys may be in any order
+    std::string reordered = R"({"protocol":"CNP","content":{"b":[1,2.50,"x\n"],"a":null},"unknown":{"k":[1]},"sender":"s","receiver":"r",)"
+                            R"("performative":"inform","language":"JSON","encoding":"utf-8","conversationId":7,"replyTo":null,"ontology":null,)"
+                            R"("replyWith":null,"inReplyTo":"id","replyBy":null})";
+    deserialized = serializer.deserializeCompact(reordered);
+    assert(deserialized.has_value());
+    assert(deserialized->contentText() == R"({"b":[1,2.50,"x\n"],"a":null})");
+    assert(deserialized->inReplyTo() == "id" and deserialized->getConversationId() == 7);
+    assert(deserialized->toAclMessage() == serializer.deserialize(reordered).value());
+
+    std::string batch = fmt::format(R"([{},3,{{"performative":"inform"}}])", data);
+    std::vector<std::expected<CompactAclMessage, Error>> messages = serializer.deserializeCompactBatch(batch);
+    assert(messages.size() == 3);
+    assert(messages[0].has_value() and messages[0]->toAclMessage() == message);
+    assert(not messages[1].has_value() and not messages[2].has_value());
+    assert(not serializer.deserializeCompact(batch).has_value());
+
+    std::string truncated = data.substr(0, data.size() / 2);
+    messages = serializer.deserializeCompactBatch(truncated);
+    assert(messages.size() == 1 and not messages.front().has_value());
+
+    std::expected<CompactAclMessage, Error> fromMoved = CompactAclMessage::from(AclMessage(message));
+    assert(fromMoved.has_value() and fromMoved->toAclMessage() == message);
+}
+
+
+void testSubscriptions() {
+    using namespace scaf;
+
+    RecordingAgent publisher("publisher");
+    auto first = publisher.createConversation("first");
+    auto second = publisher.createConversation("second");
+    publisher.addSubscriber("price", *first);
+    publisher.addSubscriber("price", *second, [](const nlohmann::json& content) { return content.get<int>() > 10; });
+    assert(publisher.subscriptionManager.subscriberCount("price") == 2);
+
+    for (int price : {5, 20, 30}) {
+        std::expected<void, Error> published = publisher.publish("price", AclMessageBuilder{.performative = Performative::inform, .content = price, .protocol = "subscribe"});
+        assert(published.has_value());
+    }
+    publisher.subscriptionManager.flush();
+
+    std::map<std::string, AclMessage> lastReceived;
+    JsonSerializer serializer;
+    for (Data& data : publisher.communicationHandler.getSent()) {
+        std::expected<AclMessage, Error> message = serializer.deserialize(data.data);
+        assert(message.has_value());
+        assert(message->receiver == data.from);
+        assert(message->sender == "publisher");
+        lastReceived.insert_or_assign(data.from, message.value());
+    }
+
+    assert(lastReceived.size() == 2);
+    assert(lastReceived.at("first").conversationId == first->getUid().conversationId);
+    assert(lastReceived.at("second").conversationId == second->getUid().conversationId);
+    assert(lastReceived.at("first").content == 30);
+    assert(lastReceived.at("second").content == 30);
+
+    [[maybe_unused]] SubscriptionStatistics statistics = publisher.subscriptionManager.getStatistics();
+    assert(statistics.published == 3);
+    assert(statistics.delivered + statistics.coalesced == 5);
+    assert(statistics.failed == 0);
+
+    // subscribe and cancel received by agent are routed to subscription manager, subscription ends with its conversation
+    SubscribingAgent agent("agent");
+    deliver(agent, makeReceivedMessage(Performative::subscribe, "remote", "fipa-subscribe", 1, "weather"));
+    deliver(agent, makeReceivedMessage(Performative::request_whenever, "remote", "fipa-subscribe", 2, {{"topic", "weather"}}));
+    deliver(agent, makeReceivedMessage(Performative::subscribe, "remote", "fipa-subscribe", 3, {{"city", "Oslo"}}));  // without topic, left to behaviour
+    deliver(agent, makeReceivedMessage(Performative::subscribe, "remote", "fipa-subscribe", 4, "secret"));  // refused
+    assert(agent.subscriptionManager.subscriberCount("weather") == 2);
+    assert(agent.subscriptionManager.subscriberCount("secret") == 0);
+    deliver(agent, makeReceivedMessage(Performative::cancel, "remote", "fipa-subscribe", 1, nullptr));
+    assert(agent.subscriptionManager.subscriberCount("weather") == 1);
+
+    publisher.subscriptionManager.unsubscribe("price", first->getUid());
+    assert(publisher.subscriptionManager.subscriberCount("price") == 1);
+}
+
+void testAsyncSend() {
+    using namespace scaf;
+
+    RecordingAgent agent("agent");
+    agent.setAsyncSendOptions(AsyncSendOptions{.maxBatchSize = 5, .flushLatency = std::chrono::seconds(1)});
+
+    std::vector<SendHandle> handles;
+    for (int i = 0; i < 5; ++i) {
+        AclMessage message = AclMessageBuilder{.performative = Performative::inform, .content = i, .protocol = "CNP"};
+        message.receiver = i % 2 ? "odd" : "even";
+        handles.push_back(agent.sendMessageAsync(std::move(message)));
+    }
+    for (SendHandle& handle : handles) {
+        [[maybe_unused]] std::expected<void, Error> status = handle.wait();
+        assert(status.has_value());
+        assert(handle.isReady());
+    }
+
+    std::vector<Data> sent = agent.communicationHandler.getSent();
+    assert(sent.size() == 2);  // one write per receiver
+
+    JsonSerializer serializer;
+    for (Data& data : sent) {
+        std::vector<std::expected<CompactAclMessage, Error>> messages = serializer.deserializeCompactBatch(data.data);
+        [[maybe_unused]] int expected = data.from == "even" ? 0 : 1;
+        for ([[maybe_unused]] std::expected<CompactAclMessage, Error>& message : messages) {
+            assert(message.has_value());
+            assert(message->receiver() == data.from);
+            assert(message->content() == expected);
+            expected += 2;
+        }
+    }
+}
+
+void testRequestCorrelation() {
+    using namespace scaf;
+
+    RecordingAgent agent("agent");
+    AclMessage request = AclMessageBuilder{.performative = Performative::query_ref, .content = "price", .protocol = "query"};
+    request.receiver = "seller";
+    std::future reply = agent.sendRequest(std::move(request));
+    assert(agent.correlationTable.size() == 1);
+
+    JsonSerializer serializer;
+    std::expected<AclMessage, Error> sent = serializer.deserialize(agent.communicationHandler.getSent().back().data);
+    assert(sent.has_value() and sent->replyWith.has_value());
+
+    AclMessage answer{
+        .performative = Performative::inform,
+        .sender = "seller",
+        .receiver = "agent",
+        .content = 42,
+        .protocol = "query",
+        .conversationId = sent->conversationId,
+        .inReplyTo = sent->replyWith,
+    };
+    std::string data = serializer.serialize(answer).value();
+    agent.handleData(Data{.from = "seller", .data = data});
+
+    assert(reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    std::expected<AclMessage, Error> received = reply.get();
+    assert(received.has_value() and received->content == 42);
+    assert(agent.correlationTable.size() == 0);
+
+    // expired without any message being received
+    AclMessage expiring = AclMessageBuilder{.performative = Performative::query_if, .content = "available", .protocol = "query"};
+    expiring.receiver = "seller";
+    std::future expired = agent.sendRequest(std::move(expiring), std::chrono::system_clock::now() + std::chrono::milliseconds(20));
+    [[maybe_unused]] std::future_status status = expired.wait_for(std::chrono::seconds(5));
+    assert(status == std::future_status::ready);
+    [[maybe_unused]] std::expected<AclMessage, Error> expiredReply = expired.get();
+    assert(not expiredReply.has_value() and expiredReply.error().getRetCode() == RetCode::expired_message);
+    assert(agent.correlationTable.size() == 0);
+
+    // request with the same manual replyWith replaces earlier one, which gets error instead of broken promise
+    AclMessage duplicate = AclMessageBuilder{.performative = Performative::query_ref, .content = "price", .protocol = "query", .replyWith = "manual"};
+    duplicate.receiver = "seller";
+    std::future replaced = agent.sendRequest(AclMessage(duplicate));
+    [[maybe_unused]] std::future replacing = agent.sendRequest(std::move(duplicate));
+    assert(replaced.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    [[maybe_unused]] std::expected<AclMessage, Error> replacedReply = replaced.get();
+    assert(not replacedReply.has_value() and replacedReply.error().getRetCode() == RetCode::generic_error);
+    assert(agent.correlationTable.size() == 1);
+
+    // only requests with passed deadline are expired, completed ones are skipped
+    CorrelationTable table;
+    const CorrelationTable::Clock::time_point start = CorrelationTable::Clock::now() + std::chrono::hours(1);
+    int expiredCount = 0;
+    std::vector<std::string> tokens;
+    for (int i = 0; i < 100; ++i) {
+        tokens.push_back(table.add("seller", [&](std::expected<AclMessage, Error>&& expiredRequest) {
+            expiredCount += not expiredRequest.has_value() and expiredRequest.error().getRetCode() == RetCode::expired_message;
+        }, start + std::chrono::seconds(i)));
+    }
+    for (std::size_t i = 0; i < tokens.size(); i += 2)
+        table.remove(tokens[i]);
+    [[maybe_unused]] std::size_t swept = table.sweepExpired(start + std::chrono::seconds(49));
+    assert(swept == 25 and expiredCount == 25 and table.size() == 25);
+}
+
+void testDeadlineScheduling() {
+    using namespace scaf;
+
+    struct SchedulingAgent {
+        void dispatchMessage(CompactAclMessage&& message) {
+            std::scoped_lock guard(dispatchedMutex);
+            dispatched.push_back(message.getConversationId());
+            performatives.push_back(message.getPerformative());
+        }
+
+        void reportError(const Error& error, std::string_view = {}) {
+            errorHandler.handle(error);
+        }
+
+        DefaultErrorHandler errorHandler;
+        std::mutex dispatchedMutex;
+        std::vector<std::uint64_t> dispatched;
+        std::vector<Performative> performatives;
+    } agent;
+
+    auto now = std::chrono::system_clock::now();
+    auto makeAclMessage = [](Performative performative, std::uint64_t conversationId, std::optional<std::chrono::system_clock::time_point> replyBy) {
+        return AclMessage{.performative = performative, .sender = "sender", .receiver = "agent", .content = {},
+                          .protocol = "CNP", .conversationId = conversationId, .replyBy = replyBy};
+    };
+    auto makeMessage = [&](Performative performative, std::uint64_t conversationId, std::optional<std::chrono::system_clock::time_point> replyBy) {
+        return CompactAclMessage::from(makeAclMessage(performative, conversationId, replyBy)).value();
+    };
+
+    DeadlineScheduler<SchedulingAgent> scheduler(&agent);
+    scheduler.push(makeMessage(Performative::inform, 1, std::nullopt));
+    scheduler.push(makeMessage(Performative::inform, 2, std::nullopt));
+    scheduler.push(makeMessage(Performative::propose, 3, now + std::chrono::seconds(5)));
+    scheduler.push(makeMessage(Performative::request, 4, std::nullopt));
+    scheduler.push(makeMessage(Performative::propose, 5, now - std::chrono::seconds(1)));  // already expired
+    assert(scheduler.size() == 4);
+
+    scheduler.enable(DeadlineSchedulerOptions{});
+    [[maybe_unused]] bool dispatched = waitUntil([&] { return scheduler.getStatistics().dispatched == 4; });
+    assert(dispatched);
+    scheduler.stop();
+
+    assert((agent.dispatched == std::vector<std::uint64_t>{4, 3, 1, 2}));
+    [[maybe_unused]] DeadlineStatistics statistics = scheduler.getStatistics();
+    assert(statistics.expired == 1);
+    assert(statistics.late == 0);
+    assert(statistics.dropped == 0);
+
+    // messages still pending when scheduler is stopped are counted as dropped
+    scheduler.push(makeMessage(Performative::inform, 6, std::nullopt));
+    scheduler.push(makeMessage(Performative::inform, 7, std::nullopt));
+    scheduler.stop();
+    statistics = scheduler.getStatistics();
+    assert(statistics.dropped == 2 and scheduler.size() == 0);
+
+    // urgent request doesn't overtake inform sent before it in the same conversation, but it speeds it up
+    scheduler.push(makeMessage(Performative::inform, 10, std::nullopt));
+    scheduler.push(makeMessage(Performative::request, 10, std::nullopt));
+    scheduler.push(makeMessage(Performative::request, 11, std::nullopt));
+    scheduler.enable(DeadlineSchedulerOptions{});
+    dispatched = waitUntil([&] { return scheduler.getStatistics().dispatched == 7; });
+    assert(dispatched);
+    scheduler.stop();
+    assert((agent.dispatched == std::vector<std::uint64_t>{4, 3, 1, 2, 10, 10, 11}));
+    assert((std::ranges::equal(agent.performatives | std::views::drop(4), std::vector{Performative::inform, Performative::request, Performative::request})));
+
+    RecordingAgent recordingAgent("agent");
+    recordingAgent.enableDeadlineScheduling();
+    deliver(recordingAgent, makeReceivedMessage(Performative::inform, "sender", "CNP", 8, nullptr));
+    dispatched = waitUntil([&] { return recordingAgent.getDeadlineStatistics().dispatched == 1; });
+    assert(dispatched);
+}
+
+void testShmCommunication() {
+    using namespace scaf;
+
+    // lost message fails the test instead of blocking it
+    ShmOptions options{.maxPeers = 2, .ringCapacity = 64, .receiveTimeout = std::chrono::seconds(1)};
+    std::expected<ShmCommunicationHandler, Error> first = ShmCommunicationHandler::create("scaf_tests_first", options);
+    std::expected<ShmCommunicationHandler, Error> second = ShmCommunicationHandler::create("scaf_tests_second", options);
+    assert(first.has_value() and second.has_value());
+    [[maybe_unused]] std::expected<ShmCommunicationHandler, Error> duplicate = ShmCommunicationHandler::create("scaf_tests_first", options);
+    assert(not duplicate.has_value());  // owner is running
+
+    for (int i = 0; i < 20; ++i) {  // wraps around ring several times
+        std::string data = fmt::format("message {}", i);
+        [[maybe_unused]] std::expected<void, Error> sent = first->send("scaf_tests_second", data);
+        assert(sent.has_value());
+        sent = first->send("scaf_tests_second", data + "!");
+        assert(sent.has_value());
+
+        [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+        assert(received.has_value() and received->from == "scaf_tests_first" and received->data == data);
+        received = second->receive();
+        assert(received.has_value() and received->data == data + "!");
+    }
+
+    // sender waits in full ring until receiver frees space
+    std::jthread sender([&] {
+        for (int i = 0; i < 50; ++i) {
+            [[maybe_unused]] std::expected<void, Error> sent = first->send("scaf_tests_second", fmt::format("queued {}", i));
+            assert(sent.has_value());
+        }
+    });
+    for (int i = 0; i < 50; ++i) {
+        [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+        assert(received.has_value() and received->data == fmt::format("queued {}", i));
+    }
+    sender.join();
+
+    [[maybe_unused]] std::expected<void, Error> sent = first->send("scaf_tests_second", std::string(64, 'x'));
+    assert(not sent.has_value());  // larger than ring
+    sent = first->send("scaf_tests_missing", "data");
+    assert(not sent.has_value());
+
+    // process exiting without cleanup leaves its segment and ring claimed in segment of receiver
+    pid_t child = fork();
+    if (child == 0) {
+        std::expected<ShmCommunicationHandler, Error> exiting = ShmCommunicationHandler::create("scaf_tests_exiting", options);
+        _exit(exiting.has_value() and exiting->send("scaf_tests_second", "last").has_value() ? 0 : 1);
+    }
+    [[maybe_unused]] int childStatus = 0;
+    waitpid(child, &childStatus, 0);
+    assert(WIFEXITED(childStatus) and WEXITSTATUS(childStatus) == 0);
+
+    [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+    assert(received.has_value() and received->from == "scaf_tests_exiting" and received->data == "last");
+    sent = first->send("scaf_tests_exiting", "lost");  // segment is left, but its owner is dead
+    assert(not sent.has_value());
+
+    std::expected<ShmCommunicationHandler, Error> third = ShmCommunicationHandler::create("scaf_tests_third", options);
+    assert(third.has_value());
+    sent = third->send("scaf_tests_second", "reclaimed");  // both rings were claimed, ring of dead sender is reused
+    assert(sent.has_value());
+    received = second->receive();
+    assert(received.has_value() and received->from == "scaf_tests_third" and received->data == "reclaimed");
+    [[maybe_unused]] std::expected<ShmCommunicationHandler, Error> replacement = ShmCommunicationHandler::create("scaf_tests_exiting", options);
+    assert(replacement.has_value());  // stale segment is replaced
+    sent = first->send("scaf_tests_exiting", "replaced");
+    assert(sent.has_value());
+    received = replacement->receive();
+    assert(received.has_value() and received->from == "scaf_tests_first" and received->data == "replaced");
+
+    // sender attached to segment of receiver which exited cleanly attaches to segment of its new instance
+    for (const char* data : {"first instance", "second instance"}) {
+        std::expected<ShmCommunicationHandler, Error> restarted = ShmCommunicationHandler::create("scaf_tests_restarted", options);
+        assert(restarted.has_value());
+        sent = first->send("scaf_tests_restarted", data);
+        assert(sent.has_value());
+        received = restarted->receive();
+        assert(received.has_value() and received->data == data);
+    }
+    sent = first->send("scaf_tests_restarted", "lost");  // segment was unlinked
+    assert(not sent.has_value());
+
+    received = second->receive();  // nothing was sent
+    assert(not received.has_value() and received.error().getRetCode() == RetCode::generic_error);
+
+    std::jthread stopper([&] { second->stop(); });
+    received = second->receive();
+    assert(not received.has_value() and received.error().getRetCode() == RetCode::terminating);
+}
+
+void testUdpCommunication() {
+    using namespace scaf;
+
+    UdpOptions options;
+    options.maxDatagramSize = 256;
+    options.reliable = true;
+    options.retransmitTimeout = std::chrono::milliseconds(5);
+    options.maxRetransmits = 3;
+    std::expected<UdpCommunicationHandler, Error> second = UdpCommunicationHandler::create(options);
+    std::expected<UdpCommunicationHandler, Error> silent = UdpCommunicationHandler::create(options);  // never acknowledges
+    assert(second.has_value() and silent.has_value());
+
+    options.peers = {{"second", fmt::format("127.0.0.1:{}", second->getPort())}, {"silent", fmt::format("127.0.0.1:{}", silent->getPort())}};
+    std::expected<UdpCommunicationHandler, Error> first = UdpCommunicationHandler::create(options);
+    assert(first.has_value());
+    const std::string firstAddress = fmt::format("127.0.0.1:{}", first->getPort());
+
+    const std::string large(2000, 'x');  // fragmented
+    [[maybe_unused]] std::expected<void, Error> sent = first->send("second", "small");
+    assert(sent.has_value());
+    sent = first->send("second", large);
+    assert(sent.has_value());
+    auto body = std::make_shared<const std::string>("body");
+    const SharedData batch[] = {{.to = "second", .header = "first ", .body = body}, {.to = "second", .header = "second ", .body = body}};
+    sent = first->sendBatch(batch);
+    assert(sent.has_value());
+    sent = first->send("unknown", "data");
+    assert(not sent.has_value());
+
+    for ([[maybe_unused]] const std::string& expected : {std::string("small"), large, std::string("first body"), std::string("second body")}) {
+        [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+        assert(received.has_value() and received->from == firstAddress and received->data == expected);
+    }
+
+    // restarted sender on the same address starts new session, its message ids aren't taken for duplicates
+    UdpOptions restartOptions = options;
+    std::string restartedAddress;
+    {
+        std::expected<UdpCommunicationHandler, Error> previous = UdpCommunicationHandler::create(restartOptions);
+        assert(previous.has_value());
+        restartOptions.port = previous->getPort();
+        restartedAddress = fmt::format("127.0.0.1:{}", restartOptions.port);
+        sent = previous->send("second", "before restart");
+        assert(sent.has_value());
+        [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+        assert(received.has_value() and received->from == restartedAddress and received->data == "before restart");
+    }
+    std::expected<UdpCommunicationHandler, Error> restarted = UdpCommunicationHandler::create(restartOptions);
+    assert(restarted.has_value());
+    sent = restarted->send("second", "after restart");
+    assert(sent.has_value());
+    [[maybe_unused]] std::expected<Data, Error> received = second->receive();
+    assert(received.has_value() and received->from == restartedAddress and received->data == "after restart");
+
+    // acknowledgements from second are processed, message to silent peer is given up after retransmissions
+    sent = first->send("silent", "lost");
+    assert(sent.has_value());
+    received = first->receive();
+    assert(not received.has_value() and received.error().getMessage() == "Message to silent dropped after 3 retransmissions");
+
+    std::jthread stopper([&] { second->stop(); });
+    received = second->receive();
+    assert(not received.has_value() and received.error().getRetCode() == RetCode::terminating);
+}
+
+void testMultiProtocolAgent() {
+    using namespace scaf;
+
+    MultiProtocolAgent agent("agent");
+    deliver(agent, makeReceivedMessage(Performative::call_for_proposal, "peer", "fipa-contract-net", 1, "cfp"));
+    deliver(agent, makeReceivedMessage(Performative::query_ref, "peer", "fipa-query", 2, "price"));
+    deliver(agent, makeReceivedMessage(Performative::propose, "peer", "", 1, "proposal"));     // existing conversation, protocol isn't checked again
+    deliver(agent, makeReceivedMessage(Performative::inform, "peer", "unknown", 3, "ignored"));  // no binding, reported as error
+
+    using Handled [[maybe_unused]] = std::pair<std::string, nlohmann::json>;
+    assert((agent.handled == std::vector<Handled>{{"negotiation", "cfp"}, {"query", "price"}, {"negotiation", "proposal"}}));
+
+    auto conversation = agent.createConversation<QueryBehaviour<MultiProtocolAgent>>("other");
+    assert(conversation);
+    [[maybe_unused]] auto active = agent.conversationHandler.getConversation(conversation->getUid());
+    assert(std::holds_alternative<std::shared_ptr<QueryBehaviour<MultiProtocolAgent>>>(active));
+    static_assert(std::same_as<decltype(agent.createConversation("other")), std::shared_ptr<NegotiationBehaviour<MultiProtocolAgent>>>);
+}
+
+void testResponseCache() {
+    using namespace scaf;
+
+    CachingAgent agent("agent");
+    agent.enableResponseCache(ResponseCacheOptions{.capacity = 2, .timeToLive = std::chrono::hours(1)});
+
+    auto query = [](const std::string& sender, std::uint64_t conversationId, std::string_view content) {
+        return makeReceivedMessage(Performative::query_ref, sender, "fipa-query", conversationId, nlohmann::json::parse(content), fmt::format("r{}", conversationId));
+    };
+    auto lastReply = [&] {
+        return nlohmann::json::parse(agent.communicationHandler.getSent().back().data).get<AclMessage>();
+    };
+
+    deliver(agent, query("first", 1, R"({"item": "apple", "unit": "kg"})"));
+    deliver(agent, query("second", 2, R"({"unit":"kg","item":"apple"})"));  // the same content
+    assert(agent.computed == 1);
+    AclMessage reply = lastReply();
+    assert(reply.receiver == "second" and reply.conversationId == 2 and reply.inReplyTo == "r2");
+    assert(reply.performative == Performative::inform_ref and reply.sender == "agent" and reply.content == 101);
+
+    deliver(agent, query("first", 3, R"({"item": "pear"})"));
+    deliver(agent, query("first", 4, R"({"item": "plum"})"));  // evicts apple
+    deliver(agent, query("first", 5, R"({"item": "apple", "unit": "kg"})"));  // evicts pear
+    assert(agent.computed == 4 and lastReply().content == 104);
+
+    deliver(agent, makeReceivedMessage(Performative::inform, "first", "fipa-query", 6, nlohmann::json::object()));  // invalidates everything
+    deliver(agent, query("first", 7, R"({"item": "apple", "unit": "kg"})"));
+    assert(agent.computed == 6 and lastReply().content == 106 and lastReply().inReplyTo == "r7");
+
+    // reply from cache to request without replyWith has inReplyTo null
+    AclMessage withoutReplyWith = query("second", 8, R"({"item": "apple", "unit": "kg"})");
+    withoutReplyWith.replyWith = std::nullopt;
+    deliver(agent, withoutReplyWith);
+    assert(agent.computed == 6 and agent.communicationHandler.getSent().back().data.contains(R"("inReplyTo":null)"));
+    reply = lastReply();
+    assert(reply.receiver == "second" and reply.conversationId == 8 and not reply.inReplyTo.has_value() and reply.content == 106);
+
+    // request in running conversation reaches its behaviour instead of cache
+    deliver(agent, makeReceivedMessage(Performative::request, "first", "fipa-query", 9, "watch"));
+    deliver(agent, query("first", 9, R"({"item": "apple", "unit": "kg"})"));
+    assert(agent.computed == 8 and lastReply().content == 108 and lastReply().inReplyTo == "r9");
+
+    [[maybe_unused]] ResponseCacheStatistics statistics = agent.getResponseCacheStatistics().value();
+    assert(statistics.hits == 2 and statistics.misses == 5);
+    assert(statistics.evictions == 2 and statistics.invalidations == 2 and statistics.size == 1);
+
+    // when too many requests wait for reply, the oldest one is forgotten
+    ResponseCache cache(ResponseCacheOptions{.capacity = 2, .timeToLive = std::chrono::hours(1)});
+    for (std::uint64_t conversationId : {3, 1, 2}) {
+        std::expected<CompactAclMessage, Error> request = CompactAclMessage::from(query("first", conversationId, "{}"));
+        assert(request.has_value());
+        [[maybe_unused]] std::optional<ResponseCache::Body> cached = cache.lookup(request.value());
+        assert(not cached.has_value());
+    }
+    [[maybe_unused]] std::optional<ResponseCacheKey> pending = cache.takePending(UniqueConversationId(3, "first"));
+    assert(not pending.has_value());
+    pending = cache.takePending(UniqueConversationId(1, "first"));
+    assert(pending.has_value());
+    pending = cache.takePending(UniqueConversationId(2, "first"));
+    assert(pending.has_value());
+
+    // fields of reply which belong to one requester aren't shared
+    AclMessage expecting = AclMessageBuilder{.performative = Performative::inform_ref, .content = 1, .protocol = "fipa-query"};
+    expecting.replyWith = "confirm";
+    expecting.replyBy = std::chrono::system_clock::now();
+    assert(not ResponseCache::isCacheableReply(expecting));
+    [[maybe_unused]] std::expected body = JsonSerializer().serializeSharedReply(expecting);
+    assert(body.has_value() and body.value()->contains(R"("replyBy":null)") and body.value()->contains(R"("replyWith":null)"));
+}
+
+void testErrorPipeline() {
+    using namespace scaf;
+
+    class CountingErrorHandler : public ErrorHandler {
+    public:
+        void handle(const Error& error) noexcept override {
+            std::scoped_lock guard(handledMutex);
+            handled.push_back(error);
+        }
+
+        std::mutex handledMutex;
+        std::vector<Error> handled;
+    } errorHandler;
+
+    ErrorPipeline pipeline(errorHandler, ErrorPipelineOptions{.window = std::chrono::hours(1)});
+    for (int i = 0; i < 50; ++i)  // message doesn't make error different
+        pipeline.report(Error(RetCode::deserialization_error, fmt::format("invalid message {}", i)), "peer");
+    pipeline.report(Error(RetCode::deserialization_error, "truncated message"), "peer");  // different source location isn't suppressed
+    for (RetCode code : {RetCode::deserialization_error, RetCode::generic_error})         // neither is different code
+        pipeline.report(Error(code, "unexpected message"), "peer");
+
+    // forwarded without waiting for next report or end of window
+    [[maybe_unused]] bool forwarded = waitUntil([&] { return pipeline.getStatistics().forwarded == 4; });
+    assert(forwarded);
+    pipeline.stop();
+
+    [[maybe_unused]] ErrorPipelineStatistics statistics = pipeline.getStatistics();
+    assert(statistics.reported == 53);
+    assert(statistics.dropped == 0);
+    assert(statistics.suppressed == 49);
+    assert(statistics.forwarded == 5);  // first of every kind and summary of suppressed ones
+
+    assert(errorHandler.handled.size() == 5);
+    assert(errorHandler.handled[0].getMessage() == "invalid message 0");
+    assert(errorHandler.handled[1].getMessage() == "truncated message");
+    assert(errorHandler.handled[2].getRetCode() == RetCode::deserialization_error);
+    assert(errorHandler.handled[3].getRetCode() == RetCode::generic_error);
+    assert(errorHandler.handled[4].getMessage().starts_with("invalid message 0 (suppressed 49 repeated errors from 'peer'"));
+
+    // errors with distinct messages and senders are rate limited, summarized by one error and tracked in bounded map
+    errorHandler.handled.clear();
+    ErrorPipeline flooded(errorHandler, ErrorPipelineOptions{.queueCapacity = 8192, .window = std::chrono::hours(1), .maxAggregates = 1000});
+    for (int i = 0; i < 5000; ++i)
+        flooded.report(Error(RetCode::generic_error, fmt::format("error {}", i)), fmt::format("peer {}", i));
+    flooded.stop();
+
+    statistics = flooded.getStatistics();
+    assert(statistics.reported == 5000 and statistics.dropped == 0);
+    assert(statistics.forwarded == 101 and statistics.suppressed == 4900);
+    assert(errorHandler.handled.back().getMessage().ends_with(", 4899 other errors suppressed"));
+
+    RecordingAgent agent("agent");
+    assert(not agent.getErrorStatistics().has_value());
+    agent.enableAsyncErrorReporting();
+    std::string invalid = "{";
+    agent.handleData(Data{.from = "peer", .data = invalid});
+    assert(agent.getErrorStatistics().has_value() and agent.getErrorStatistics()->reported == 1);
+}
+
+void testChunkedContent() {
+    using namespace scaf;
+
+    nlohmann::json document = nlohmann::json::array();
+    for (int i = 0; i < 100; ++i)
+        document.push_back({{"line", i}, {"text", "żółw zażółcił gęślą jaźń"}});
+
+    RecordingAgent sender("sender");
+    sender.setAsyncSendOptions(AsyncSendOptions{.maxBatchSize = 2, .flushLatency = std::chrono::milliseconds(100)});
+    auto conversation = sender.createConversation("receiver");
+
+    AclMessage large = AclMessageBuilder{.performative = Performative::inform, .content = document, .protocol = "CNP"};
+    AclMessage following = AclMessageBuilder{.performative = Performative::inform, .content = "following", .protocol = "CNP"};
+    AclMessage other = AclMessageBuilder{.performative = Performative::inform, .content = "other", .protocol = "CNP"};
+    other.receiver = "receiver";
+
+    SendHandle largeHandle = sender.sendMessageChunked(*conversation, std::move(large), 128);
+    SendHandle followingHandle = sender.sendMessageAsync(*conversation, std::move(following));
+    SendHandle otherHandle = sender.sendMessageAsync(std::move(other));
+    for (const SendHandle& handle : {largeHandle, followingHandle, otherHandle}) {
+        [[maybe_unused]] std::expected<void, Error> status = handle.wait();
+        assert(status.has_value());
+    }
+
+    // message of other conversation isn't blocked by large one, message of the same conversation waits for its last chunk
+    std::vector<Data> sent = sender.communicationHandler.getSent();
+    assert(sent.size() > document.dump().size() / 128);
+    assert(sent.back().data.find("\"following\"") != std::string::npos);
+    assert(sent.front().data.find("\"other\"") == std::string::npos and sent[sent.size() - 2].data.find("\"other\"") == std::string::npos);
+
+    ContentRecordingAgent receiver("receiver");
+    JsonSerializer serializer;
+    for (Data& data : sent) {
+        [[maybe_unused]] std::optional<ContentChunk> chunk;
+        [[maybe_unused]] std::expected<AclMessage, Error> message = serializer.deserialize(data.data);
+        assert(message.has_value());
+        chunk = getContentChunk(message.value());
+        assert(not chunk.has_value() or nlohmann::json(chunk->data).dump().size() <= 128 + 2);  // escaped data and quotes
+        receiver.handleData(std::move(data));
+    }
+
+    assert((receiver.received == std::vector<nlohmann::json>{"other", document, "following"}));
+
+    // chunked reply for request sent with sendRequest is reassembled and passed to its callback
+    RecordingAgent requester("requester");
+    AclMessage request = AclMessageBuilder{.performative = Performative::query_ref, .content = "document", .protocol = "fipa-query"};
+    request.receiver = "sender";
+    std::future reply = requester.sendRequest(std::move(request));
+    request = nlohmann::json::parse(requester.communicationHandler.getSent().back().data).get<AclMessage>();
+
+    AclMessage response = AclMessageBuilder{.performative = Performative::inform_ref, .content = document, .protocol = "fipa-query"};
+    response.receiver = "requester";
+    response.inReplyTo = request.replyWith;
+    const std::size_t sentBefore = sender.communicationHandler.getSent().size();
+    [[maybe_unused]] std::expected<void, Error> status = sender.sendMessageChunked(std::move(response), 128).wait();
+    assert(status.has_value());
+
+    sent = sender.communicationHandler.getSent();
+    for (std::size_t i = sentBefore; i < sent.size(); ++i) {
+        assert(reply.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+        requester.handleData(std::move(sent[i]));
+    }
+    [[maybe_unused]] std::expected<AclMessage, Error> replied = reply.get();
+    assert(replied.has_value() and replied->content == document and replied->performative == Performative::inform_ref);
+
+    // transport can reorder chunks, content is complete once all of them arrived
+    const std::string text = document.dump();
+    ContentSplitter splitter(1, std::string(text), 128);
+    std::vector<ContentChunk> chunks;
+    while (not splitter.finished())
+        chunks.push_back(splitter.next());
+
+    ContentReassembler reassembler;
+    std::expected<std::optional<nlohmann::json>, Error> content;
+    for (std::size_t i = chunks.size(); i-- > 0;) {
+        content = reassembler.append(chunks[i]);
+        assert(content.has_value() and content->has_value() == (i == 0));
+    }
+    assert(content->value() == document);
+
+    content = reassembler.append(chunks[1]);
+    assert(content.has_value() and not content->has_value());
+    content = reassembler.append(chunks[1]);  // received twice
+    assert(not content.has_value());
+
+    // size announced by sender and content buffered for all streams are limited
+    ContentReassembler limited(text.size());
+    bool rejected = false;
+    for (ContentChunk chunk : chunks) {
+        for (std::uint64_t stream : {1, 2}) {
+            chunk.stream = stream;
+            rejected = rejected or not limited.append(chunk).has_value();
+        }
+    }
+    assert(rejected);
+    content = ContentReassembler(text.size() - 1).append(chunks[0]);
+    assert(not content.has_value());
+}
+
 
 int main() {
     testJsonSerialization();
+    testCompactAclMessage();
+    testSubscriptions();
+    testAsyncSend();
+    testRequestCorrelation();
+    testDeadlineScheduling();
+    testMultiProtocolAgent();
+    testResponseCache();
+    testShmCommunication();
+    testUdpCommunication();
+    testErrorPipeline();
+    testChunkedContent();
 
     std::unique_ptr<MyAgent> myAgent;
     myAgent = std::make_unique<MyAgent>("MyAgent");